@@ -1,3 +1,16 @@
+// Outside of the guard, a precompiled prefix header might have included it before release
+// defines SSR_SCRIPTID
+#if defined(SSR_SCRIPT)
+#undef ssr_func
+#if defined(SSR_SCRIPTID)
+#define _ssr_func_paste(a, b) a##$##b
+#define _ssr_func_eval(a, b) _ssr_func_paste(a, b)
+#define ssr_func(ret, name) SSR_EXTERN SSR_EXPORT ret _ssr_func_eval(SSR_SCRIPTID, name)
+#else
+#define ssr_func(ret, name) SSR_EXTERN SSR_EXPORT ret name
+#endif
+#endif
+
 #ifndef _SSR_H_GUARD_
 #define _SSR_H_GUARD_
 
@@ -20,7 +33,7 @@
 #endif
 
 #if defined(SSR_SCRIPT)
-#if __cplusplus__
+#ifdef __cplusplus
 #define SSR_EXTERN extern "C"
 #else
 #define SSR_EXTERN
@@ -31,14 +44,6 @@
 #elif defined(SSR_LINUX)
 #define SSR_EXPORT __attribute__((visibility("default")))
 #endif
-
-#if defined(SSR_SCRIPTID)
-#define _ssr_func_paste(a, b) a##$##b
-#define _ssr_func_eval(a, b) _ssr_func_paste(a, b)
-#define ssr_func(ret, name) SSR_EXTERN __declspec(dllexport) ret _ssr_func_eval(SSR_SCRIPTID, name)
-#else
-#define ssr_func(ret, name) SSR_EXTERN SSR_EXPORT ret name
-#endif
 #else
 
 // libc includes
@@ -62,10 +67,12 @@ Usage:
 Macros:
     SSR_LIVE - If defined scripts will dynamically recompiled and updated by the
         daemon. Otherwise all the files will be compiled on the run().
+    SSR_STATIC_REGISTRY - Release only, scripts have been linked into the host from the
+        archive built with SSR_FLAGS_STATIC. run() doesn't compile anything.
  */
 
 #ifndef SSR_MAX_SCRIPTS
-#define SSR_MAX_SCRIPTS 128 // TODO: not really needed atm
+#define SSR_MAX_SCRIPTS 128 // initial capacity of the script map, it grows past it
 #endif
 
 #ifndef SSR_BIN_DIR
@@ -96,16 +103,58 @@ Macros:
 #define SSR_SLEEP_MS 16
 #endif
 
+#ifndef SSR_AR_EXEC
+#define SSR_AR_EXEC "ar" // archiver for gcc & clang, SSR_FLAGS_STATIC
+#endif
+
+#if !defined(SSR_SHM_DIR) && defined(__linux__)
+#define SSR_SHM_DIR "/dev/shm" // SSR_FLAGS_SHM, memory backed
+#endif
+
+#ifndef SSR_LIBTCC // SSR_COMPILER_TCC, loaded at runtime
+#ifdef _WIN32
+#define SSR_LIBTCC "libtcc.dll"
+#else
+#define SSR_LIBTCC "libtcc.so"
+#endif
+#endif
+
+#ifndef SSR_DEBOUNCE_MS
+#define SSR_DEBOUNCE_MS 50
+#endif
+
+#ifndef SSR_KEEP_VERSIONS
+#define SSR_KEEP_VERSIONS 2 // live: superseded libraries kept per script
+#endif
+
+#ifndef SSR_BIN_BUDGET
+#define SSR_BIN_BUDGET ((size_t) 512 << 20) // live: bytes SSR_BIN_DIR is trimmed to
+#endif
+
+#ifndef SSR_EVICT_MS
+#define SSR_EVICT_MS 60000 // live: unused or deleted scripts are unloaded after this long
+#endif
+
 #ifdef SSR_STATIC
 #define SSR_DEF static
 #else
 #define SSR_DEF extern
 #endif
 
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define SSR_INLINE static __inline
+#define _SSR_TLS __declspec(thread)
+#else
+#define SSR_INLINE static inline
+#define _SSR_TLS __thread
+#endif
+
 enum SSR_COMPILER {
     SSR_COMPILER_MSVC,  // no need for vcvars/cl/link to be in PATH
     SSR_COMPILER_CLANG, // assumes clang is a valid command
     SSR_COMPILER_GCC,   // assumes gcc is a valid command
+    SSR_COMPILER_TCC,   // in process through SSR_LIBTCC, live builds never touch the disk
 };
 
 enum SSR_MSVC_VER {
@@ -125,6 +174,30 @@ enum SSR_FLAGS {
 
     SSR_FLAGS_GEN_OPT1 = 1 << 1,
     SSR_FLAGS_GEN_OPT2 = 1 << 2,
+
+    SSR_FLAGS_CACHE = 1 << 3, // reuses artifacts in SSR_BIN_DIR/cache built from the same input
+
+    // release: scripts and registry are also archived in SSR_BIN_DIR/ssr.a (ssr.lib), the host
+    // can then be linked with it and built with SSR_STATIC_REGISTRY
+    SSR_FLAGS_STATIC = 1 << 4,
+
+    // Whole program optimization, the optimizer sees across scripts linked together (release)
+    SSR_FLAGS_LTO = 1 << 5,
+    // release: scripts in the same directory are compiled as a single translation unit, names
+    // with internal linkage have to be unique among them
+    SSR_FLAGS_UNITY = 1 << 6,
+
+    // live: changes are first built unoptimized and swapped in, the optimized build (-O2)
+    // replaces it once ready. See ssr_tier().
+    SSR_FLAGS_TIERED = 1 << 7,
+
+    // live: libraries that are not cached are built in SSR_SHM_DIR and unlinked once loaded,
+    // they never touch SSR_BIN_DIR. Ignored if SSR_SHM_DIR is not defined.
+    SSR_FLAGS_SHM = 1 << 8,
+
+    // live: with SSR_FLAGS_TIERED the optimized build targets the host CPU (-march=native). Its
+    // libraries, cached and indexed ones included, then only run on the same kind of CPU.
+    SSR_FLAGS_NATIVE = 1 << 9,
 };
 
 #ifdef __cplusplus
@@ -147,6 +220,11 @@ typedef struct ssr_config_t {
     const char* msvc141_path;
     int target_arch;            // SSR_ARCH
     int flags;                  // SSR_FLAGS
+    int num_jobs;               // concurrent compiler processes, 0 is one per core. Live: shared
+    int debounce_ms;            // live: quiet time before changed scripts are rebuilt
+    int keep_versions;          // live: superseded libraries kept per script once unloaded
+    size_t bin_budget;          // live: bytes SSR_BIN_DIR is trimmed to, 0 is unbounded
+    int evict_ms;               // live: grace before unused or deleted scripts are unloaded
     char* compile_args_beg;     // added before any other flag
     char* compile_args_end;     // added before input files
     char* link_args_beg;        // added before any other flag
@@ -154,15 +232,35 @@ typedef struct ssr_config_t {
     char** include_directories; // compiler include directories
     char** link_libraries;      // libraries to link to - absolute paths
     char** defines;             // name=value strings
+    char** prefix_headers;      // included before every script, precompiled with gcc and clang
     size_t num_include_directories;
     size_t num_link_libraries;
     size_t num_defines;
+    size_t num_prefix_headers;
 } ssr_config_t;
 
 
+typedef struct ssr_stats_t {
+    size_t cache_hits;   // builds satisfied from SSR_BIN_DIR/cache (SSR_FLAGS_CACHE)
+    size_t cache_misses; // builds that had to invoke the compiler (SSR_FLAGS_CACHE)
+} ssr_stats_t;
+
 typedef void* ssr_func_t;
 typedef void (*ssr_cb_t)(int, const char*); // flags is SSR_CB_*** | [SSR_CB_ERROR]
 typedef void* ssr_routine_t;
+
+// Release, functions exported by all scripts sorted by id and fname. Generated by ssr_run() and
+// linked with the scripts as ssr$registry.
+typedef struct ssr_registry_entry_t {
+    const char* id;
+    const char* fname;
+    ssr_func_t addr;
+} ssr_registry_entry_t;
+
+typedef struct ssr_registry_t {
+    size_t len;
+    const ssr_registry_entry_t* entries;
+} ssr_registry_t;
 #define SSR_SEP \
     '$' // Not the best looking separator indeed, but it makes life slightly easier as it's also
         // valid as a function character (TODO)
@@ -176,13 +274,155 @@ SSR_DEF bool ssr_run(struct ssr_t*);
 SSR_DEF bool ssr_add(struct ssr_t*, const char*, const char*, ssr_func_t*);
 SSR_DEF void ssr_remove(struct ssr_t*, const char*, const char*, ssr_func_t*);
 SSR_DEF void ssr_cb(struct ssr_t*, int mask, ssr_cb_t);
+SSR_DEF void ssr_stats(struct ssr_t*, ssr_stats_t*);
+
+// Live and gcc only, the script is rebuilt instrumented (-fprofile-generate) and once it has
+// been running for window_ms rebuilt again with the collected profile (-fprofile-use). Every
+// change to the source starts over. Profiles are kept in SSR_BIN_DIR/pgo.
+SSR_DEF bool ssr_pgo(struct ssr_t*, const char*, unsigned int window_ms);
+
+// Version of the script the routine is currently running, with SSR_FLAGS_TIERED 0 is the quick
+// unoptimized build and 1 the optimized one. Always 1 without tiering, -1 if not built yet.
+SSR_DEF int ssr_tier(struct ssr_t*, const char*, const char*);
+
+// Incremented every time a new version of the routine is published, NULL if it hasn't been
+// added. The counter lives as long as ssr, read it with ssr_load_gen().
+SSR_DEF const uint32_t* ssr_generation(struct ssr_t*, const char*, const char*);
+
+/* Routines are swapped by the daemon while other threads might be calling through them.
+   Publication is a release store, loading through ssr_load() (acquire) makes sure the new
+   version is completely visible before calling it. Generations are stored after the routine.
+*/
+SSR_INLINE void* _ssr_load_ptr(void* const* ptr) {
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_IX86) || defined(_M_X64) // loads are acquire already, only the compiler reorders
+    void* ret = *(void* const volatile*) ptr;
+    _ReadWriteBarrier();
+    return ret;
+#else
+    return _InterlockedCompareExchangePointer((void* volatile*) ptr, NULL, NULL);
+#endif
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+SSR_INLINE void _ssr_store_ptr(void** ptr, void* val) {
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_IX86) || defined(_M_X64)
+    _ReadWriteBarrier();
+    *(void* volatile*) ptr = val;
+#else
+    _InterlockedExchangePointer((void* volatile*) ptr, val);
+#endif
+#else
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#endif
+}
+
+SSR_INLINE uint32_t _ssr_load_u32(const uint32_t* ptr) {
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_IX86) || defined(_M_X64)
+    uint32_t ret = *(const volatile uint32_t*) ptr;
+    _ReadWriteBarrier();
+    return ret;
+#else
+    return (uint32_t) _InterlockedCompareExchange((volatile long*) ptr, 0, 0);
+#endif
+#else
+    return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+SSR_INLINE void _ssr_store_u32(uint32_t* ptr, uint32_t val) {
+#if defined(_MSC_VER) && !defined(__clang__)
+#if defined(_M_IX86) || defined(_M_X64)
+    _ReadWriteBarrier();
+    *(volatile uint32_t*) ptr = val;
+#else
+    _InterlockedExchange((volatile long*) ptr, (long) val);
+#endif
+#else
+    __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#endif
+}
+
+// Store followed by a full barrier, later loads can't be moved before it
+SSR_INLINE void _ssr_store_fence_u32(uint32_t* ptr, uint32_t val) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    _InterlockedExchange((volatile long*) ptr, (long) val);
+#else
+    __atomic_store_n(ptr, val, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
 
+// Returns the previous value
+SSR_INLINE uint32_t _ssr_fetch_add_u32(uint32_t* ptr, uint32_t val) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return (uint32_t) _InterlockedExchangeAdd((volatile long*) ptr, (long) val);
+#else
+    return __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
 #endif
+}
+
+SSR_INLINE ssr_func_t ssr_load(ssr_func_t* routine) { return _ssr_load_ptr(routine); }
+SSR_INLINE uint32_t ssr_load_gen(const uint32_t* gen) { return _ssr_load_u32(gen); }
+
+/* Slots are the cheaper alternative to ssr_add(): every script has a dispatch table with the
+   address of all its routines, reloading replaces the whole table with a single store. Calls
+   load the table and index it, all routines of a script always come from the same version.
+*/
+typedef struct ssr_slot_t {
+    void** const* table; // current dispatch table of the script, NULL until it's first built
+    size_t idx;
+} ssr_slot_t;
+
+// Stable until ssr_destroy(), NULL if the routine can't be found (release only)
+SSR_DEF const ssr_slot_t* ssr_slot(struct ssr_t*, const char*, const char*);
+// Same as ssr_slot() with script id and function name already hashed by the caller
+// (_ssr_hash_str(), scriptosaurus.hpp does it at compile time)
+SSR_DEF const ssr_slot_t*
+ssr_slot_h(struct ssr_t*, uint64_t, const char*, uint64_t, const char*);
+
+SSR_INLINE ssr_func_t ssr_slot_load(const ssr_slot_t* slot) {
+    void* const* table = (void* const*) _ssr_load_ptr((void* const*) slot->table);
+    return table != NULL ? table[slot->idx] : NULL;
+}
+
+/* The previous version of a script is unloaded only once every registered thread has been
+   seen outside of script code after the swap. Threads calling routines concurrently with
+   the daemon register once and wrap calls in ssr_enter()/ssr_leave(), long running loops
+   can stay inside and call ssr_quiescent() every iteration instead. Threads which are not
+   registered are not waited for.
+*/
+typedef struct ssr_thread_t {
+    uint32_t epoch;         // 0 outside of script code, otherwise last epoch observed
+    const uint32_t* global; // bumped by the daemon every time a library is swapped
+    uint8_t _pad[64];       // records of different threads never share a cache line
+} ssr_thread_t;
+
+SSR_DEF ssr_thread_t* ssr_thread_register(struct ssr_t*);
+SSR_DEF void ssr_thread_unregister(struct ssr_t*, ssr_thread_t*); // outside of script code
+
+// Not reentrant, routines have to be loaded after entering
+SSR_INLINE void ssr_enter(ssr_thread_t* thread) {
+    _ssr_store_fence_u32(&thread->epoch, _ssr_load_u32(thread->global));
+}
+
+SSR_INLINE void ssr_leave(ssr_thread_t* thread) { _ssr_store_u32(&thread->epoch, 0); }
+
+// Between ssr_enter() and ssr_leave(), no routine loaded before is going to be called again
+SSR_INLINE void ssr_quiescent(ssr_thread_t* thread) {
+    _ssr_store_u32(&thread->epoch, _ssr_load_u32(thread->global));
+}
 
 #ifdef __cplusplus
 }
 #endif
 
+#endif
+
 /*-----------------------------------------------------------------------------
 Internal API
     _ssr_str
@@ -203,7 +443,7 @@ static void _ssr_free(char* ptr);
 static _ssr_str_t _ssr_str_e(void);
 static _ssr_str_t _ssr_str(const char* src);
 static _ssr_str_t _ssr_str_f(const char* fmt, ...);
-static _ssr_str_t _ssr_str_rnd(size_t len);
+static _ssr_str_t _ssr_str_uniq(size_t len); // lowercase letters, unique among processes
 static void _ssr_str_destroy(_ssr_str_t);
 static char* _ssr_strncpy(char* a, const char* b, size_t n);
 
@@ -220,14 +460,25 @@ static size_t _ssr_vec_capacity(const _ssr_vec_t* vec);
 static size_t _ssr_vec_len(_ssr_vec_t* vec);
 static void* _ssr_vec_at(_ssr_vec_t* vec, size_t idx);
 static void _ssr_vec_push(_ssr_vec_t* vec, const void* el);
+static void _ssr_vec_push_n(_ssr_vec_t* vec, const void* els, size_t n);
 static void _ssr_vec_remove(_ssr_vec_t* vec, const void* el);
-
-#define _SSR_MAP_CAPACITY SSR_MAX_SCRIPTS * 4
-#define _SSR_MAP_HASH_MASK (_ssr_hash_t) 1 << 63
+static void _ssr_vec_clear(_ssr_vec_t* vec);
+
+/* Open addressing with linear probing, a group of _SSR_MAP_GROUP control bytes is compared
+   at once (SSE2 if available). Every slot has a control byte, either _SSR_MAP_EMPTY or 7 bits
+   of the hash of its entry. Entries start at key_off with the _ssr_hash_t of the key followed
+   by the _ssr_str_t key itself, which is always compared. Removing shifts the entries after
+   it back instead of leaving a tombstone. Grows past 7/8 full, adding and removing move
+   entries around.
+*/
+#define _SSR_MAP_GROUP 16
+#define _SSR_MAP_EMPTY 0x80
 typedef struct __ssr_map_t {
     uint8_t* buf;
+    uint8_t* ctrl; // capacity bytes, followed by the first _SSR_MAP_GROUP - 1 again
     size_t size;
-    size_t mask;
+    size_t mask; // capacity - 1
+    size_t len;
     size_t key_off;
 } _ssr_map_t;
 typedef uint64_t _ssr_hash_t;
@@ -235,12 +486,21 @@ typedef void (*_ssr_map_iter_cb_t)(void* el, void* args);
 
 static void _ssr_map(_ssr_map_t* map, size_t entry_size, size_t key_off);
 static void _ssr_map_destroy(_ssr_map_t* map);
-static void* _ssr_map_find(_ssr_map_t* map, _ssr_hash_t hash);
+static void* _ssr_map_find(_ssr_map_t* map, _ssr_hash_t hash, const char* key);
 static void* _ssr_map_find_str(_ssr_map_t* map, const char* key);
-static void _ssr_map_add(_ssr_map_t* map, const void* _obj, _ssr_hash_t hash);
-static void _ssr_map_add_str(_ssr_map_t* map, const void* _obj);
+static void* _ssr_map_add(_ssr_map_t* map, const void* _obj, _ssr_hash_t hash); // not in map
+static void* _ssr_map_add_str(_ssr_map_t* map, const void* _obj);
+#ifdef SSR_LIVE
+static void _ssr_map_remove(_ssr_map_t* map, void* el); // el from find or add
+#endif
 static void _ssr_map_iter(_ssr_map_t* map, _ssr_map_iter_cb_t cb, void* args);
 
+// 64-bit FNV-1a, seed is the hash of the previous chunk (or 0) to chain multiple inputs
+static _ssr_hash_t _ssr_hash(const void* data, size_t len, _ssr_hash_t seed);
+static _ssr_hash_t _ssr_hash_str(const char* str, _ssr_hash_t seed); // NULL is the empty string
+static _ssr_hash_t _ssr_hash_xxh64(const void* data, size_t len, _ssr_hash_t seed); // bulk data
+static bool _ssr_hash_file(const char* path, _ssr_hash_t* hash); // XXH64 of the content
+
 
 /*-----------------------------------------------------------------------------
 Internal System API
@@ -250,9 +510,20 @@ Internal System API
     string & file helpers
 */
 struct _ssr_lock_t;
+struct _ssr_cond_t;
+struct _ssr_once_t; // statically initialized with _SSR_ONCE_INIT
 struct _ssr_thread_t;
 struct _ssr_lib_t;
-typedef uint64_t _ssr_timestamp_t;
+#define _SSR_CACHE_LINE 64
+typedef uint64_t _ssr_timestamp_t; // as precise as the file system allows
+
+// Cheap signature of a file, if none of them changed the content didn't either
+typedef struct __ssr_file_info_t {
+    _ssr_timestamp_t written;
+    uint64_t size;
+    uint64_t id; // inode or file index
+} _ssr_file_info_t;
+
 typedef void (*_ssr_iter_dir_cb_t)(void* args, const char*, const char*);
 
 static void _ssr_lock(struct _ssr_lock_t* lock);
@@ -260,16 +531,40 @@ static void _ssr_lock_destroy(struct _ssr_lock_t* lock);
 static void _ssr_lock_acq(struct _ssr_lock_t* lock);
 static void _ssr_lock_rel(struct _ssr_lock_t* lock);
 
+static void _ssr_cond(struct _ssr_cond_t* cond);
+static void _ssr_cond_destroy(struct _ssr_cond_t* cond);
+static void _ssr_cond_wait(struct _ssr_cond_t* cond, struct _ssr_lock_t* lock); // lock held once
+static void _ssr_cond_wake(struct _ssr_cond_t* cond);                          // wakes all
+
+static void _ssr_once(struct _ssr_once_t* once, void (*fn)(void)); // fn runs a single time
+
 static bool _ssr_thread(struct _ssr_thread_t* thread, void* fun, void* args);
 static void _ssr_thread_join(struct _ssr_thread_t* thread);
+static unsigned int _ssr_num_cores(void);
+static uint32_t _ssr_pid(void);
+#ifdef SSR_LIVE
+static void* _ssr_aligned_alloc(size_t size); // _SSR_CACHE_LINE, NULL on failure
+#endif
+static void _ssr_aligned_free(void* ptr);
 
 static const char* _ssr_lib_ext(void);
+#ifndef SSR_LIVE
+static const char* _ssr_archive_ext(void);
+#endif
 static bool _ssr_lib(struct _ssr_lib_t* lib, const char* path);
 static void _ssr_lib_destroy(struct _ssr_lib_t* lib);
 static void* _ssr_lib_func_addr(struct _ssr_lib_t* lib, const char* fname);
+static void _ssr_tcc_delete(void* state);                   // _ssr_lib_t::mem
+static void* _ssr_tcc_symbol(void* state, const char* name); // _ssr_lib_t::mem
 
 static _ssr_timestamp_t _ssr_file_timestamp(const char* path);
+#ifdef SSR_LIVE
+static bool _ssr_file_info(const char* path, _ssr_file_info_t* info); // zeroed if missing
+#endif
 static bool _ssr_file_exists(const char* path);
+static const void* _ssr_file_map(const char* path, size_t* len); // read-only, NULL if empty
+static void _ssr_file_unmap(const void* addr, size_t len);
+static bool _ssr_file_replace(const char* from, const char* to);
 static _ssr_str_t _ssr_fullpath(const char* rel);
 static _ssr_str_t _ssr_remove_ext(const char* str, long long len);
 static const char* _ssr_extract_rel(const char* base, const char* path);
@@ -280,6 +575,39 @@ static void _ssr_new_dir(const char* dir);
 static void _ssr_sleep(unsigned int ms);
 static int _ssr_run(char* cmd, _ssr_str_t* out, _ssr_str_t* err);
 
+#ifndef SSR_LIVE
+// Global functions defined in an object file, false if it's not in the native format (LTO)
+typedef void (*_ssr_obj_symbols_cb_t)(void* args, const char* name);
+static bool _ssr_obj_symbols(const char* path, _ssr_obj_symbols_cb_t cb, void* args);
+#endif
+
+#ifdef SSR_LIVE
+static bool _ssr_path_in(const char* root, const char* path); // root itself or below
+static void _ssr_remove_dir(const char* dir);                 // only if empty
+static uint64_t _ssr_now_ms(void);                             // monotonic
+
+// Change notification, only available on some platforms. When _ssr_watch_root() fails or
+// _ssr_watch_wait() returns false the caller is expected to fall back to polling _ssr_iter_dir
+struct _ssr_watch_t;
+static bool _ssr_watch(struct _ssr_watch_t* watch); // no roots yet
+static void _ssr_watch_destroy(struct _ssr_watch_t* watch);
+static bool _ssr_watch_root(struct _ssr_watch_t* watch, const char* root); // whole tree
+static void _ssr_watch_unroot(struct _ssr_watch_t* watch, const char* root);
+static bool _ssr_watch_dir(struct _ssr_watch_t* watch, const char* dir); // files only, anywhere
+static bool
+_ssr_watch_wait(struct _ssr_watch_t* watch, int timeout_ms, _ssr_iter_dir_cb_t cb, void* args);
+static void _ssr_watch_wake(struct _ssr_watch_t* watch);
+#endif
+
+// Worker threads consuming jobs in FIFO order, more can be added but never removed
+struct __ssr_pool_t;
+typedef void (*_ssr_job_fn_t)(void* args);
+
+static bool _ssr_pool(struct __ssr_pool_t* pool, size_t num_threads);
+static bool _ssr_pool_grow(struct __ssr_pool_t* pool, size_t num_threads); // up to num_threads
+static void _ssr_pool_destroy(struct __ssr_pool_t* pool); // waits for queued jobs
+static void _ssr_pool_push(struct __ssr_pool_t* pool, _ssr_job_fn_t fn, void* args);
+
 /*-----------------------------------------------------------------------------
     Implementation
 */
@@ -314,14 +642,18 @@ static _ssr_str_t _ssr_str_f(const char* fmt, ...) {
     return ret;
 }
 
-static _ssr_str_t _ssr_str_rnd(size_t len) {
+// Base 26 of the process id followed by a counter, threads and processes sharing a directory
+// never pick the same temporary. With SSR_SL_LEN >= 10 the counter wraps every 2^24 names and
+// pids up to 2^22 are distinct, callers still check that names are not taken.
+static _ssr_str_t _ssr_str_uniq(size_t len) {
+    static uint32_t counter = 0;
     if (len == 0) return _ssr_str_e();
+    uint64_t n = (uint64_t) _ssr_pid() << 24 | (_ssr_fetch_add_u32(&counter, 1) & 0xffffff);
     _ssr_str_t ret;
     ret.b = _ssr_alloc(len + 1);
-    size_t i;
-    for (i = 0; i < len; ++i)
-        ret.b[i] = (char) (97 + (rand() % 25));
-    ret.b[i] = '\0';
+    for (size_t i = len; i > 0; --i, n /= 26)
+        ret.b[i - 1] = (char) ('a' + n % 26);
+    ret.b[len] = '\0';
     return ret;
 }
 
@@ -365,17 +697,22 @@ static size_t _ssr_vec_capacity(const _ssr_vec_t* vec) { return (vec->end - vec-
 
 static void* _ssr_vec_at(_ssr_vec_t* vec, size_t idx) { return vec->beg + idx * vec->size; }
 
-static void _ssr_vec_push(_ssr_vec_t* vec, const void* el) {
+static void _ssr_vec_push(_ssr_vec_t* vec, const void* el) { _ssr_vec_push_n(vec, el, 1); }
+
+static void _ssr_vec_push_n(_ssr_vec_t* vec, const void* els, size_t n) {
     size_t capacity = _ssr_vec_capacity(vec);
-    if (_ssr_vec_len(vec) >= capacity) {
+    size_t len      = _ssr_vec_len(vec);
+    if (len + n > capacity) {
         size_t new_capacity = capacity * 2 > 32 ? capacity * 2 : 32;
-        vec->beg            = (uint8_t*) realloc(vec->beg, vec->size * new_capacity);
-        vec->cur            = vec->beg;
-        vec->end            = vec->beg + new_capacity * vec->size;
+        while (new_capacity < len + n)
+            new_capacity *= 2;
+        vec->beg = (uint8_t*) realloc(vec->beg, vec->size * new_capacity);
+        vec->cur = vec->beg + len * vec->size;
+        vec->end = vec->beg + new_capacity * vec->size;
     }
 
-    memcpy(vec->cur, el, vec->size);
-    vec->cur += vec->size;
+    memcpy(vec->cur, els, vec->size * n);
+    vec->cur += vec->size * n;
 }
 
 // swaps with last
@@ -392,79 +729,262 @@ static void _ssr_vec_remove(_ssr_vec_t* vec, const void* obj) {
     }
 }
 
+static void _ssr_vec_clear(_ssr_vec_t* vec) { vec->cur = vec->beg; }
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define _SSR_SSE2
+#endif
+
+// FNV-1a is weak in the low bits, which pick the slot
+static uint64_t _ssr_map_mix(_ssr_hash_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 33);
+}
+
+// Bit i is set if ctrl[i] == byte
+static uint32_t _ssr_map_match(const uint8_t* ctrl, uint8_t byte) {
+#ifdef _SSR_SSE2
+    __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char) byte)));
+#else
+    uint32_t ret = 0;
+    for (uint32_t i = 0; i < _SSR_MAP_GROUP; ++i)
+        ret |= (uint32_t) (ctrl[i] == byte) << i;
+    return ret;
+#endif
+}
+
+static uint32_t _ssr_ctz(uint32_t x) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long ret;
+    _BitScanForward(&ret, x);
+    return (uint32_t) ret;
+#else
+    return (uint32_t) __builtin_ctz(x);
+#endif
+}
+
+static void _ssr_map_alloc(_ssr_map_t* map, size_t capacity) {
+    map->buf  = (uint8_t*) malloc(map->size * capacity);
+    map->ctrl = (uint8_t*) malloc(capacity + _SSR_MAP_GROUP - 1);
+    memset(map->ctrl, _SSR_MAP_EMPTY, capacity + _SSR_MAP_GROUP - 1);
+    map->mask = capacity - 1;
+    map->len  = 0;
+}
+
 static void _ssr_map(_ssr_map_t* map, size_t entry_size, size_t key_off) {
-    map->buf = (uint8_t*) malloc(entry_size * _SSR_MAP_CAPACITY);
-    memset(map->buf, 0, entry_size * _SSR_MAP_CAPACITY);
+    size_t capacity = _SSR_MAP_GROUP;
+    while (capacity < SSR_MAX_SCRIPTS) capacity <<= 1;
     map->size    = entry_size;
-    map->mask    = _SSR_MAP_CAPACITY - 1;
     map->key_off = key_off;
+    _ssr_map_alloc(map, capacity);
 }
 
 static void _ssr_map_destroy(_ssr_map_t* map) {
     if (map != NULL) {
         free(map->buf);
-        map->buf = 0;
+        free(map->ctrl);
+        map->buf  = NULL;
+        map->ctrl = NULL;
     }
 }
 
-static void* _ssr_map_find(_ssr_map_t* map, _ssr_hash_t hash) {
-    size_t base = (size_t) hash & map->mask;
-    for (size_t i = 0; i <= map->mask; ++i) {
-        uint8_t* cur          = map->buf + (((base + i) & map->mask) * map->size);
-        uint8_t* cur_key      = cur + map->key_off;
-        _ssr_hash_t* cur_hash = (_ssr_hash_t*) cur_key;
+static void _ssr_map_set_ctrl(_ssr_map_t* map, size_t i, uint8_t ctrl) {
+    map->ctrl[i] = ctrl;
+    if (i < _SSR_MAP_GROUP - 1) map->ctrl[map->mask + 1 + i] = ctrl;
+}
+
+static size_t _ssr_map_home(_ssr_map_t* map, _ssr_hash_t hash) {
+    return (size_t) (_ssr_map_mix(hash) >> 7) & map->mask;
+}
 
-        if ((uint32_t) *cur_hash == (uint32_t) hash) return cur;
+static void* _ssr_map_find(_ssr_map_t* map, _ssr_hash_t hash, const char* key) {
+    uint8_t h2 = (uint8_t) (_ssr_map_mix(hash) & 0x7f);
+    size_t pos = _ssr_map_home(map, hash);
+    for (;;) {
+        const uint8_t* group = map->ctrl + pos;
+        for (uint32_t match = _ssr_map_match(group, h2); match != 0; match &= match - 1) {
+            uint8_t* cur = map->buf + ((pos + _ssr_ctz(match)) & map->mask) * map->size;
+            uint8_t* cur_key = cur + map->key_off;
+            if (*(_ssr_hash_t*) cur_key == hash &&
+                strcmp(((_ssr_str_t*) (cur_key + sizeof(_ssr_hash_t)))->b, key) == 0)
+                return cur;
+        }
 
-        if ((*cur_hash & _SSR_MAP_HASH_MASK) == 0) return NULL;
+        // Entries are never past an empty slot after their home
+        if (_ssr_map_match(group, _SSR_MAP_EMPTY) != 0) return NULL;
+        pos = (pos + _SSR_MAP_GROUP) & map->mask;
     }
+}
 
-    return NULL;
+static void* _ssr_map_insert(_ssr_map_t* map, const void* _obj, _ssr_hash_t hash) {
+    size_t pos = _ssr_map_home(map, hash);
+    uint32_t empty;
+    while ((empty = _ssr_map_match(map->ctrl + pos, _SSR_MAP_EMPTY)) == 0)
+        pos = (pos + _SSR_MAP_GROUP) & map->mask;
+
+    size_t i     = (pos + _ssr_ctz(empty)) & map->mask;
+    uint8_t* cur = map->buf + i * map->size;
+    memcpy(cur, _obj, map->size);
+    *(_ssr_hash_t*) (cur + map->key_off) = hash;
+    _ssr_map_set_ctrl(map, i, (uint8_t) (_ssr_map_mix(hash) & 0x7f));
+    ++map->len;
+    return cur;
 }
 
-static uint32_t _fnv_32_str(const char* str, uint32_t hval) {
-    unsigned char* s = (unsigned char*) str;
-    while (*s) {
-        hval += (hval << 1) + (hval << 4) + (hval << 7) + (hval << 8) + (hval << 24);
-        hval ^= (uint32_t) *s++;
+static _ssr_hash_t _ssr_hash(const void* data, size_t len, _ssr_hash_t seed) {
+    const unsigned char* p = (const unsigned char*) data;
+    _ssr_hash_t hval       = seed == 0 ? 0xcbf29ce484222325ULL : seed;
+    for (size_t i = 0; i < len; ++i) {
+        hval ^= (_ssr_hash_t) p[i];
+        hval *= 0x100000001b3ULL;
     }
     return hval;
 }
 
-static void* _ssr_map_find_str(_ssr_map_t* map, const char* key) {
-    uint32_t hash = _fnv_32_str(key, 0);
-    return _ssr_map_find(map, hash);
+// The terminator is part of the input, otherwise "ab","c" and "a","bc" would collide
+static _ssr_hash_t _ssr_hash_str(const char* str, _ssr_hash_t seed) {
+    if (str == NULL) str = "";
+    return _ssr_hash(str, strlen(str) + 1, seed);
 }
 
-static void _ssr_map_add(_ssr_map_t* map, const void* _obj, _ssr_hash_t hash) {
-    size_t base = (size_t) hash & map->mask;
-    for (size_t i = 0; i <= map->mask; ++i) {
-        uint8_t* cur          = map->buf + (((base + i) & map->mask) * map->size);
-        uint8_t* cur_key      = cur + map->key_off;
-        _ssr_hash_t* cur_hash = (_ssr_hash_t*) cur_key;
+// XXH64, FNV-1a goes through input one byte at a time. Little endian only.
+#define _SSR_XXH_P1 0x9E3779B185EBCA87ULL
+#define _SSR_XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define _SSR_XXH_P3 0x165667B19E3779F9ULL
+#define _SSR_XXH_P4 0x85EBCA77C2B2AE63ULL
+#define _SSR_XXH_P5 0x27D4EB2F165667C5ULL
 
-        if ((*cur_hash & _SSR_MAP_HASH_MASK) == 0) {
-            memcpy(cur, _obj, map->size);
-            *cur_hash = (uint64_t) hash | (uint64_t) 1 << 63;
-            return;
+static uint64_t _ssr_rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static uint64_t _ssr_xxh64_round(uint64_t acc, const unsigned char* p) {
+    uint64_t input;
+    memcpy(&input, p, sizeof(uint64_t));
+    acc += input * _SSR_XXH_P2;
+    return _ssr_rotl64(acc, 31) * _SSR_XXH_P1;
+}
+
+static uint64_t _ssr_xxh64_merge(uint64_t acc, uint64_t v) {
+    v   = _ssr_rotl64(v * _SSR_XXH_P2, 31) * _SSR_XXH_P1;
+    acc = acc ^ v;
+    return acc * _SSR_XXH_P1 + _SSR_XXH_P4;
+}
+
+static _ssr_hash_t _ssr_hash_xxh64(const void* data, size_t len, _ssr_hash_t seed) {
+    const unsigned char* p   = (const unsigned char*) data;
+    const unsigned char* end = p + len;
+
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + _SSR_XXH_P1 + _SSR_XXH_P2;
+        uint64_t v2 = seed + _SSR_XXH_P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - _SSR_XXH_P1;
+        do {
+            v1 = _ssr_xxh64_round(v1, p);
+            v2 = _ssr_xxh64_round(v2, p + 8);
+            v3 = _ssr_xxh64_round(v3, p + 16);
+            v4 = _ssr_xxh64_round(v4, p + 24);
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = _ssr_rotl64(v1, 1) + _ssr_rotl64(v2, 7) + _ssr_rotl64(v3, 12) + _ssr_rotl64(v4, 18);
+        h = _ssr_xxh64_merge(h, v1);
+        h = _ssr_xxh64_merge(h, v2);
+        h = _ssr_xxh64_merge(h, v3);
+        h = _ssr_xxh64_merge(h, v4);
+    } else {
+        h = seed + _SSR_XXH_P5;
+    }
+    h += (uint64_t) len;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= _ssr_xxh64_round(0, p);
+        h = _ssr_rotl64(h, 27) * _SSR_XXH_P1 + _SSR_XXH_P4;
+    }
+    if (p + 4 <= end) {
+        uint32_t input;
+        memcpy(&input, p, sizeof(uint32_t));
+        h ^= (uint64_t) input * _SSR_XXH_P1;
+        h = _ssr_rotl64(h, 23) * _SSR_XXH_P2 + _SSR_XXH_P3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (uint64_t) *p * _SSR_XXH_P5;
+        h = _ssr_rotl64(h, 11) * _SSR_XXH_P1;
+    }
+
+    h ^= h >> 33;
+    h *= _SSR_XXH_P2;
+    h ^= h >> 29;
+    h *= _SSR_XXH_P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static bool _ssr_hash_file(const char* path, _ssr_hash_t* hash) {
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    char buf[1024 * 16];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+        *hash = _ssr_hash_xxh64(buf, len, *hash);
+    fclose(fp);
+    return true;
+}
+
+static void* _ssr_map_find_str(_ssr_map_t* map, const char* key) {
+    return _ssr_map_find(map, _ssr_hash_str(key, 0), key);
+}
+
+static void* _ssr_map_add(_ssr_map_t* map, const void* _obj, _ssr_hash_t hash) {
+    if ((map->len + 1) * 8 > (map->mask + 1) * 7) {
+        uint8_t* buf    = map->buf;
+        uint8_t* ctrl   = map->ctrl;
+        size_t capacity = map->mask + 1;
+        _ssr_map_alloc(map, capacity * 2);
+        for (size_t i = 0; i < capacity; ++i) {
+            uint8_t* cur = buf + i * map->size;
+            if (ctrl[i] != _SSR_MAP_EMPTY)
+                _ssr_map_insert(map, cur, *(_ssr_hash_t*) (cur + map->key_off));
         }
+        free(buf);
+        free(ctrl);
     }
+    return _ssr_map_insert(map, _obj, hash);
 }
 
-static void _ssr_map_add_str(_ssr_map_t* map, const void* _obj) {
+static void* _ssr_map_add_str(_ssr_map_t* map, const void* _obj) {
     _ssr_str_t* str = (_ssr_str_t*) ((const char*) _obj + map->key_off + sizeof(_ssr_hash_t));
-    uint32_t hash   = _fnv_32_str(str->b, 0);
-    _ssr_map_add(map, _obj, hash);
+    return _ssr_map_add(map, _obj, _ssr_hash_str(str->b, 0));
 }
 
-static void _ssr_map_iter(_ssr_map_t* map, _ssr_map_iter_cb_t cb, void* args) {
-    for (size_t i = 0; i <= map->mask; ++i) {
-        uint8_t* cur          = map->buf + (i & map->mask) * map->size;
-        uint8_t* cur_key      = cur + map->key_off;
-        _ssr_hash_t* cur_hash = (_ssr_hash_t*) cur_key;
-
-        if ((*cur_hash & _SSR_MAP_HASH_MASK) != 0x0) cb(cur, args);
+#ifdef SSR_LIVE
+// Entries after el that would rather be where it is are moved back, one at a time
+static void _ssr_map_remove(_ssr_map_t* map, void* el) {
+    size_t i = (size_t) ((uint8_t*) el - map->buf) / map->size;
+    for (size_t j = (i + 1) & map->mask; map->ctrl[j] != _SSR_MAP_EMPTY; j = (j + 1) & map->mask) {
+        uint8_t* cur = map->buf + j * map->size;
+        size_t home  = _ssr_map_home(map, *(_ssr_hash_t*) (cur + map->key_off));
+        if (((j - home) & map->mask) < ((j - i) & map->mask)) continue; // home is in (i, j]
+
+        memcpy(map->buf + i * map->size, cur, map->size);
+        _ssr_map_set_ctrl(map, i, map->ctrl[j]);
+        i = j;
     }
+    _ssr_map_set_ctrl(map, i, _SSR_MAP_EMPTY);
+    --map->len;
+}
+#endif
+
+static void _ssr_map_iter(_ssr_map_t* map, _ssr_map_iter_cb_t cb, void* args) {
+    for (size_t i = 0; i <= map->mask; ++i)
+        if (map->ctrl[i] != _SSR_MAP_EMPTY) cb(map->buf + i * map->size, args);
 }
 
 // Windows
@@ -497,6 +1017,36 @@ static void _ssr_lock_acq(struct _ssr_lock_t* lock) { EnterCriticalSection(lock-
 
 static void _ssr_lock_rel(struct _ssr_lock_t* lock) { LeaveCriticalSection(lock->h); }
 
+typedef struct _ssr_cond_t {
+    CONDITION_VARIABLE h;
+} _ssr_cond_t;
+
+static void _ssr_cond(struct _ssr_cond_t* cond) { InitializeConditionVariable(&cond->h); }
+
+static void _ssr_cond_destroy(struct _ssr_cond_t* cond) { (void) cond; }
+
+static void _ssr_cond_wait(struct _ssr_cond_t* cond, struct _ssr_lock_t* lock) {
+    SleepConditionVariableCS(&cond->h, lock->h, INFINITE);
+}
+
+static void _ssr_cond_wake(struct _ssr_cond_t* cond) { WakeAllConditionVariable(&cond->h); }
+
+typedef struct _ssr_once_t {
+    INIT_ONCE h;
+} _ssr_once_t;
+#define _SSR_ONCE_INIT {INIT_ONCE_STATIC_INIT}
+
+static BOOL CALLBACK _ssr_once_cb(PINIT_ONCE once, PVOID fn, PVOID* ctx) {
+    (void) once;
+    (void) ctx;
+    ((void (*)(void)) fn)();
+    return TRUE;
+}
+
+static void _ssr_once(struct _ssr_once_t* once, void (*fn)(void)) {
+    InitOnceExecuteOnce(&once->h, _ssr_once_cb, (PVOID) fn, NULL);
+}
+
 typedef struct _ssr_thread_t {
     HANDLE handle;
     unsigned int id;
@@ -515,14 +1065,34 @@ static void _ssr_thread_join(struct _ssr_thread_t* thread) {
     CloseHandle(thread->handle);
 }
 
+static unsigned int _ssr_num_cores(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return si.dwNumberOfProcessors > 0 ? (unsigned int) si.dwNumberOfProcessors : 1;
+}
+
+static uint32_t _ssr_pid(void) { return (uint32_t) GetCurrentProcessId(); }
+
+#ifdef SSR_LIVE
+static void* _ssr_aligned_alloc(size_t size) { return _aligned_malloc(size, _SSR_CACHE_LINE); }
+#endif
+
+static void _ssr_aligned_free(void* ptr) { _aligned_free(ptr); }
+
 typedef struct _ssr_lib_t {
     HMODULE h;
+    bool mem; // h is the state of an in-process backend
 } _ssr_lib_t;
 
 static const char* _ssr_lib_ext(void) { return "dll"; }
 
+#ifndef SSR_LIVE
+static const char* _ssr_archive_ext(void) { return "lib"; }
+#endif
+
 static bool _ssr_lib(struct _ssr_lib_t* lib, const char* path) {
-    lib->h = LoadLibraryA(path);
+    lib->mem = false;
+    lib->h   = LoadLibraryA(path);
     if (lib->h == NULL) {
         _ssr_log(SSR_CB_ERR, "Error loading shared library: %s", path);
         return false;
@@ -531,10 +1101,16 @@ static bool _ssr_lib(struct _ssr_lib_t* lib, const char* path) {
     return true;
 }
 
-static void _ssr_lib_destroy(struct _ssr_lib_t* lib) { FreeLibrary(lib->h); }
+static void _ssr_lib_destroy(struct _ssr_lib_t* lib) {
+    if (lib->mem)
+        _ssr_tcc_delete((void*) lib->h);
+    else
+        FreeLibrary(lib->h);
+}
 
 static void* _ssr_lib_func_addr(struct _ssr_lib_t* lib, const char* fname) {
     if (lib == NULL) return NULL;
+    if (lib->mem) return _ssr_tcc_symbol((void*) lib->h, fname);
     return (void*) GetProcAddress(lib->h, fname);
 }
 
@@ -554,8 +1130,104 @@ static _ssr_timestamp_t _ssr_file_timestamp(const char* path) {
     return (_ssr_timestamp_t) wt_i.QuadPart;
 }
 
+#ifdef SSR_LIVE
+static bool _ssr_file_info(const char* path, _ssr_file_info_t* info) {
+    memset(info, 0, sizeof(_ssr_file_info_t));
+    HANDLE hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hfile == INVALID_HANDLE_VALUE) return false;
+
+    BY_HANDLE_FILE_INFORMATION fi;
+    bool ret = GetFileInformationByHandle(hfile, &fi);
+    CloseHandle(hfile);
+    if (!ret) return false;
+
+    info->written = (uint64_t) fi.ftLastWriteTime.dwHighDateTime << 32 | fi.ftLastWriteTime.dwLowDateTime;
+    info->size    = (uint64_t) fi.nFileSizeHigh << 32 | fi.nFileSizeLow;
+    info->id      = (uint64_t) fi.nFileIndexHigh << 32 | fi.nFileIndexLow;
+    return true;
+}
+#endif
+
 static bool _ssr_file_exists(const char* path) { return PathFileExistsA(path); }
 
+static const void* _ssr_file_map(const char* path, size_t* len) {
+    HANDLE hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hfile == INVALID_HANDLE_VALUE) return NULL;
+
+    LARGE_INTEGER size;
+    HANDLE hmap = NULL;
+    if (GetFileSizeEx(hfile, &size) && size.QuadPart > 0)
+        hmap = CreateFileMappingA(hfile, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(hfile);
+    if (hmap == NULL) return NULL;
+
+    // The view keeps the mapping alive
+    const void* ret = MapViewOfFile(hmap, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(hmap);
+    *len = (size_t) size.QuadPart;
+    return ret;
+}
+
+static void _ssr_file_unmap(const void* addr, size_t len) {
+    (void) len;
+    if (addr != NULL) UnmapViewOfFile(addr);
+}
+
+static bool _ssr_file_replace(const char* from, const char* to) {
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+}
+
+#ifndef SSR_LIVE
+// COFF, objects built with /GL are not and start with IMAGE_FILE_MACHINE_UNKNOWN
+static bool _ssr_obj_symbols(const char* path, _ssr_obj_symbols_cb_t cb, void* args) {
+    size_t len;
+    const uint8_t* beg = (const uint8_t*) _ssr_file_map(path, &len);
+    if (beg == NULL) return false;
+
+    bool ret                      = false;
+    const IMAGE_FILE_HEADER* head = (const IMAGE_FILE_HEADER*) beg;
+    if (len < sizeof(IMAGE_FILE_HEADER) || head->Machine == IMAGE_FILE_MACHINE_UNKNOWN) goto end;
+
+    size_t syms_off = head->PointerToSymbolTable;
+    size_t num_syms = head->NumberOfSymbols;
+    if (syms_off + num_syms * IMAGE_SIZEOF_SYMBOL + sizeof(DWORD) > len) goto end;
+
+    // String table follows the symbols, offsets include its size
+    const char* strs = (const char*) beg + syms_off + num_syms * IMAGE_SIZEOF_SYMBOL;
+    DWORD strs_len   = *(const DWORD*) strs;
+    if (strs + strs_len > (const char*) beg + len) goto end;
+
+    for (size_t i = 0; i < num_syms; ++i) {
+        const IMAGE_SYMBOL* sym =
+            (const IMAGE_SYMBOL*) (beg + syms_off + i * IMAGE_SIZEOF_SYMBOL);
+        size_t aux = sym->NumberOfAuxSymbols;
+        if (sym->SectionNumber > 0 && sym->StorageClass == IMAGE_SYM_CLASS_EXTERNAL &&
+            ISFCN(sym->Type)) {
+            char short_name[IMAGE_SIZEOF_SHORT_NAME + 1];
+            const char* name = short_name;
+            if (sym->N.Name.Short == 0) {
+                if (sym->N.Name.Long >= strs_len) goto next;
+                name = strs + sym->N.Name.Long;
+            } else {
+                memcpy(short_name, sym->N.ShortName, IMAGE_SIZEOF_SHORT_NAME);
+                short_name[IMAGE_SIZEOF_SHORT_NAME] = '\0';
+            }
+#if defined(SSR_32)
+            if (name[0] == '_') ++name; // __cdecl decoration
+#endif
+            cb(args, name);
+        }
+    next:
+        i += aux;
+    }
+    ret = true;
+
+end:
+    _ssr_file_unmap(beg, len);
+    return ret;
+}
+#endif
+
 static _ssr_str_t _ssr_fullpath(const char* rel) {
     _ssr_str_t ret;
     ret.b = _fullpath(NULL, rel, 0);
@@ -572,7 +1244,7 @@ static void _ssr_iter_dir(const char* root, _ssr_iter_dir_cb_t cb, void* args) {
     if (hfind != INVALID_HANDLE_VALUE) {
         do {
             if (strcmp(fd.cFileName, ".") == 0 || strcmp(fd.cFileName, "..") == 0 ||
-                strcmp(fd.cFileName, ".bin") == 0)
+                strcmp(fd.cFileName, SSR_BIN_DIR) == 0)
                 continue;
 
             sprintf(path, "%s\\%s", root, fd.cFileName);
@@ -598,14 +1270,59 @@ static void _ssr_new_dir(const char* dir) {
         return;
     }
 
-    _ssr_str_t rm = _ssr_str_f("cmd.exe /C \"rd /s /q \"%s\"\"", dir);
-    _ssr_run(rm.b, NULL, NULL);
+    // Existing directories are kept as is, SSR_BIN_DIR/cache has to survive restarts
     CreateDirectoryA(dir, NULL);
-    _ssr_str_destroy(rm);
 }
 
 static void _ssr_sleep(unsigned int ms) { Sleep(ms); }
 
+#ifdef SSR_LIVE
+static void _ssr_remove_dir(const char* dir) { RemoveDirectoryA(dir); }
+
+static uint64_t _ssr_now_ms(void) { return GetTickCount64(); }
+
+// No change notification on Windows, _ssr_watch() fails and the daemon scans root and the
+// headers every SSR_SLEEP_MS instead
+typedef struct _ssr_watch_t {
+    int unused;
+} _ssr_watch_t;
+
+static bool _ssr_watch(struct _ssr_watch_t* watch) {
+    (void) watch;
+    return false;
+}
+
+static void _ssr_watch_destroy(struct _ssr_watch_t* watch) { (void) watch; }
+
+static bool _ssr_watch_root(struct _ssr_watch_t* watch, const char* root) {
+    (void) watch;
+    (void) root;
+    return false;
+}
+
+static void _ssr_watch_unroot(struct _ssr_watch_t* watch, const char* root) {
+    (void) watch;
+    (void) root;
+}
+
+static bool
+_ssr_watch_wait(struct _ssr_watch_t* watch, int timeout_ms, _ssr_iter_dir_cb_t cb, void* args) {
+    (void) watch;
+    (void) timeout_ms;
+    (void) cb;
+    (void) args;
+    return false;
+}
+
+static bool _ssr_watch_dir(struct _ssr_watch_t* watch, const char* dir) {
+    (void) watch;
+    (void) dir;
+    return false;
+}
+
+static void _ssr_watch_wake(struct _ssr_watch_t* watch) { (void) watch; }
+#endif
+
 static int _ssr_run(char* cmd, _ssr_str_t* out, _ssr_str_t* err) {
     HANDLE stdout_r, stdout_w;
     HANDLE stderr_r, stderr_w;
@@ -672,12 +1389,21 @@ static int _ssr_run(char* cmd, _ssr_str_t* out, _ssr_str_t* err) {
 #elif defined(SSR_LINUX)
 #include <dirent.h>
 #include <dlfcn.h>
+#include <elf.h>
 #include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <pthread.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+extern char** environ;
+
 typedef struct _ssr_lock_t {
     pthread_mutex_t h;
 } _ssr_lock_t;
@@ -705,15 +1431,35 @@ static void _ssr_lock_rel(struct _ssr_lock_t* lock) {
     pthread_mutex_unlock(&lock->h);
 }
 
-typedef struct _ssr_thread_t {
-    pthread_t handle;
-} _ssr_thread_t;
+typedef struct _ssr_cond_t {
+    pthread_cond_t h;
+} _ssr_cond_t;
 
-static bool _ssr_thread(struct _ssr_thread_t* thread, void* fun, void* args) {
-    typedef void* fun_t(void*);
-    if (thread == NULL || fun == NULL) return false;
-    if (pthread_create(&thread->handle, NULL, (fun_t*) fun, (void*) args)) return true;
-    return false;
+static void _ssr_cond(struct _ssr_cond_t* cond) { pthread_cond_init(&cond->h, NULL); }
+
+static void _ssr_cond_destroy(struct _ssr_cond_t* cond) { pthread_cond_destroy(&cond->h); }
+
+static void _ssr_cond_wait(struct _ssr_cond_t* cond, struct _ssr_lock_t* lock) {
+    pthread_cond_wait(&cond->h, &lock->h);
+}
+
+static void _ssr_cond_wake(struct _ssr_cond_t* cond) { pthread_cond_broadcast(&cond->h); }
+
+typedef struct _ssr_once_t {
+    pthread_once_t h;
+} _ssr_once_t;
+#define _SSR_ONCE_INIT {PTHREAD_ONCE_INIT}
+
+static void _ssr_once(struct _ssr_once_t* once, void (*fn)(void)) { pthread_once(&once->h, fn); }
+
+typedef struct _ssr_thread_t {
+    pthread_t handle;
+} _ssr_thread_t;
+
+static bool _ssr_thread(struct _ssr_thread_t* thread, void* fun, void* args) {
+    typedef void* fun_t(void*);
+    if (thread == NULL || fun == NULL) return false;
+    return pthread_create(&thread->handle, NULL, (fun_t*) fun, (void*) args) == 0;
 }
 
 static void _ssr_thread_join(struct _ssr_thread_t* thread) {
@@ -721,15 +1467,37 @@ static void _ssr_thread_join(struct _ssr_thread_t* thread) {
     pthread_join(thread->handle, NULL);
 }
 
+static unsigned int _ssr_num_cores(void) {
+    long ret = sysconf(_SC_NPROCESSORS_ONLN);
+    return ret > 0 ? (unsigned int) ret : 1;
+}
+
+static uint32_t _ssr_pid(void) { return (uint32_t) getpid(); }
+
+#ifdef SSR_LIVE
+static void* _ssr_aligned_alloc(size_t size) {
+    void* ret;
+    return posix_memalign(&ret, _SSR_CACHE_LINE, size) == 0 ? ret : NULL;
+}
+#endif
+
+static void _ssr_aligned_free(void* ptr) { free(ptr); }
+
 typedef struct _ssr_lib_t {
     void* h;
+    bool mem; // h is the state of an in-process backend
 } _ssr_lib_t;
 
 static const char* _ssr_lib_ext(void) { return "so"; }
 
+#ifndef SSR_LIVE
+static const char* _ssr_archive_ext(void) { return "a"; }
+#endif
+
 static bool _ssr_lib(struct _ssr_lib_t* lib, const char* path) {
     if (lib == NULL || path == NULL) return false;
-    lib->h = dlopen(path, RTLD_NOW);
+    lib->mem = false;
+    lib->h   = dlopen(path, RTLD_NOW);
     if (lib->h == NULL) {
         const char* err = dlerror();
         _ssr_log(SSR_CB_WARN, "%s", err);
@@ -740,11 +1508,15 @@ static bool _ssr_lib(struct _ssr_lib_t* lib, const char* path) {
 
 static void _ssr_lib_destroy(struct _ssr_lib_t* lib) {
     if (lib == NULL || lib->h == NULL) return;
-    dlclose(lib->h);
+    if (lib->mem)
+        _ssr_tcc_delete(lib->h);
+    else
+        dlclose(lib->h);
 }
 
 static void* _ssr_lib_func_addr(struct _ssr_lib_t* lib, const char* fname) {
     if (lib == NULL) return NULL;
+    if (lib->mem) return _ssr_tcc_symbol(lib->h, fname);
     return dlsym(lib->h, fname);
 }
 
@@ -752,30 +1524,123 @@ static _ssr_timestamp_t _ssr_file_timestamp(const char* path) {
     struct stat s;
     if (stat(path, &s) == -1) return 0;
 
-    return s.st_mtime;
+    return (_ssr_timestamp_t) s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+}
+
+#ifdef SSR_LIVE
+static bool _ssr_file_info(const char* path, _ssr_file_info_t* info) {
+    memset(info, 0, sizeof(_ssr_file_info_t));
+    struct stat s;
+    if (stat(path, &s) == -1) return false;
+
+    info->written = (_ssr_timestamp_t) s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+    info->size    = (uint64_t) s.st_size;
+    info->id      = (uint64_t) s.st_ino;
+    return true;
 }
+#endif
 
 static bool _ssr_file_exists(const char* path) {
     if (path == NULL) return false;
     return access(path, R_OK) != -1;
 }
 
+static const void* _ssr_file_map(const char* path, size_t* len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return NULL;
+
+    struct stat s;
+    void* ret = MAP_FAILED;
+    if (fstat(fd, &s) == 0 && s.st_size > 0)
+        ret = mmap(NULL, (size_t) s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ret == MAP_FAILED) return NULL;
+
+    *len = (size_t) s.st_size;
+    return ret;
+}
+
+static void _ssr_file_unmap(const void* addr, size_t len) {
+    if (addr != NULL) munmap((void*) addr, len);
+}
+
+static bool _ssr_file_replace(const char* from, const char* to) { return rename(from, to) == 0; }
+
+#ifndef SSR_LIVE
+#if defined(SSR_64)
+#define _SSR_ELF(type) Elf64_##type
+#else
+#define _SSR_ELF(type) Elf32_##type
+#endif
+
+// ELF relocatable of the host's class, LTO objects only have the compiler's own symbol table
+static bool _ssr_obj_symbols(const char* path, _ssr_obj_symbols_cb_t cb, void* args) {
+    size_t len;
+    const uint8_t* beg = (const uint8_t*) _ssr_file_map(path, &len);
+    if (beg == NULL) return false;
+
+    bool ret                    = false;
+    const _SSR_ELF(Ehdr)* ehdr  = (const _SSR_ELF(Ehdr)*) beg;
+    const _SSR_ELF(Shdr)* shdrs = NULL;
+    if (len < sizeof(_SSR_ELF(Ehdr)) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32))
+        goto end;
+    if (ehdr->e_shoff + (size_t) ehdr->e_shnum * sizeof(_SSR_ELF(Shdr)) > len) goto end;
+
+    shdrs = (const _SSR_ELF(Shdr)*) (beg + ehdr->e_shoff);
+
+    for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+        if (shdrs[i].sh_type != SHT_SYMTAB || shdrs[i].sh_link >= ehdr->e_shnum) continue;
+        const _SSR_ELF(Shdr)* strtab = shdrs + shdrs[i].sh_link;
+        if (shdrs[i].sh_offset + shdrs[i].sh_size > len ||
+            strtab->sh_offset + strtab->sh_size > len)
+            goto end;
+
+        const _SSR_ELF(Sym)* syms = (const _SSR_ELF(Sym)*) (beg + shdrs[i].sh_offset);
+        const char* strs          = (const char*) beg + strtab->sh_offset;
+        size_t num_syms           = shdrs[i].sh_size / sizeof(_SSR_ELF(Sym));
+        for (size_t j = 1; j < num_syms; ++j) {
+            // ST_TYPE and ST_BIND are the same for both classes
+            if (ELF64_ST_TYPE(syms[j].st_info) != STT_FUNC ||
+                ELF64_ST_BIND(syms[j].st_info) == STB_LOCAL || syms[j].st_shndx == SHN_UNDEF ||
+                syms[j].st_name >= strtab->sh_size)
+                continue;
+            cb(args, strs + syms[j].st_name);
+        }
+    }
+    ret = true;
+
+end:
+    _ssr_file_unmap(beg, len);
+    return ret;
+}
+#endif
+
 static _ssr_str_t _ssr_fullpath(const char* rel) {
     char fullpath[PATH_MAX + 1];
     if (realpath(rel, fullpath) == NULL) return _ssr_str_e();
     return _ssr_str(fullpath);
 }
 
+// Some filesystems leave d_type to DT_UNKNOWN, path is where de has been read
+static bool _ssr_dirent_is_dir(const char* path, const struct dirent* de) {
+    if (de->d_type != DT_UNKNOWN) return de->d_type == DT_DIR;
+    struct stat s;
+    return stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
 static void _ssr_iter_dir(const char* root, _ssr_iter_dir_cb_t cb, void* args) {
     DIR* dir;
     dir = opendir(root);
 
     struct dirent* de;
     while ((de = readdir(dir)) != NULL) {
-        if (de->d_type == DT_DIR) {
-            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
-            char path[PATH_MAX + 1];
-            snprintf(path, PATH_MAX + 1, "%s/%s", root, de->d_name);
+        char path[PATH_MAX + 1];
+        snprintf(path, PATH_MAX + 1, "%s/%s", root, de->d_name);
+        if (_ssr_dirent_is_dir(path, de)) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+                strcmp(de->d_name, SSR_BIN_DIR) == 0)
+                continue;
             _ssr_iter_dir(path, cb, args);
         } else
             cb(args, root, de->d_name);
@@ -790,34 +1655,394 @@ static void _ssr_new_dir(const char* dir) {
 
 static void _ssr_sleep(unsigned int ms) { usleep(ms * 1000); }
 
+#ifdef SSR_LIVE
+static void _ssr_remove_dir(const char* dir) { rmdir(dir); }
+
+static uint64_t _ssr_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// inotify backend. Every directory below the roots has its own watch descriptor, directories
+// that show up later are added as they are created or moved in. Files are only reported once
+// they have been closed after writing or moved into the tree.
+#define _SSR_WATCH_FILE_MASK (IN_CLOSE_WRITE | IN_MOVED_TO)
+#define _SSR_WATCH_MASK \
+    (_SSR_WATCH_FILE_MASK | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct _ssr_watch_t {
+    int fd;           // inotify instance, -1 once we fell back to polling
+    int wake[2];      // self-pipe written by _ssr_watch_wake(), survives the fallback
+    _ssr_vec_t roots; // _ssr_str_t, rescanned when the kernel queue overflows
+    _ssr_vec_t dirs;  // indexed by watch descriptor, full path of the directory or NULL
+} _ssr_watch_t;
+
+// Returns false only if the kernel ran out of watches, other failures are ignored as the
+// directory might have been removed in the meantime. If cb is not NULL files already inside
+// the directory are reported, as they might have been written before the watch was added.
+static bool
+_ssr_watch_add(struct _ssr_watch_t* watch, const char* dir, _ssr_iter_dir_cb_t cb, void* args) {
+    int wd = inotify_add_watch(watch->fd, dir, _SSR_WATCH_MASK);
+    if (wd == -1) return errno != ENOSPC && errno != ENOMEM;
+
+    _ssr_str_t empty = _ssr_str_e();
+    while (_ssr_vec_len(&watch->dirs) <= (size_t) wd)
+        _ssr_vec_push(&watch->dirs, &empty);
+
+    // Directories moved inside the tree keep their descriptor, only the path changes
+    _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&watch->dirs, wd);
+    _ssr_str_destroy(*path);
+    *path = _ssr_str(dir);
+
+    DIR* d = opendir(dir);
+    if (d == NULL) return true;
+
+    bool ret = true;
+    struct dirent* de;
+    while (ret && (de = readdir(d)) != NULL) {
+        char sub[PATH_MAX + 1];
+        snprintf(sub, PATH_MAX + 1, "%s/%s", dir, de->d_name);
+        if (_ssr_dirent_is_dir(sub, de)) {
+            if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+                strcmp(de->d_name, SSR_BIN_DIR) == 0)
+                continue;
+            ret = _ssr_watch_add(watch, sub, cb, args);
+        } else if (cb != NULL)
+            cb(args, dir, de->d_name);
+    }
+    closedir(d);
+    return ret;
+}
+
+// Directories already watched as part of root are left as they are
+static bool _ssr_watch_dir(struct _ssr_watch_t* watch, const char* dir) {
+    if (watch->fd == -1) return false;
+    int wd = inotify_add_watch(watch->fd, dir, _SSR_WATCH_FILE_MASK | IN_ONLYDIR | IN_MASK_ADD);
+    if (wd == -1) return false;
+
+    _ssr_str_t empty = _ssr_str_e();
+    while (_ssr_vec_len(&watch->dirs) <= (size_t) wd)
+        _ssr_vec_push(&watch->dirs, &empty);
+
+    _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&watch->dirs, wd);
+    if (path->b == NULL) *path = _ssr_str(dir);
+    return true;
+}
+
+static void _ssr_watch_close(struct _ssr_watch_t* watch) {
+    if (watch->fd != -1) close(watch->fd);
+    watch->fd = -1;
+
+    size_t dirs_len = _ssr_vec_len(&watch->dirs);
+    for (size_t i = 0; i < dirs_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&watch->dirs, i));
+    _ssr_vec_destroy(&watch->dirs);
+}
+
+static bool _ssr_watch(struct _ssr_watch_t* watch) {
+    _ssr_vec(&watch->roots, sizeof(_ssr_str_t), 8);
+    _ssr_vec(&watch->dirs, sizeof(_ssr_str_t), 64);
+
+    // The wake pipe is needed even when polling
+    watch->wake[0] = watch->wake[1] = -1;
+    if (pipe(watch->wake) == 0) {
+        for (int i = 0; i < 2; ++i) {
+            fcntl(watch->wake[i], F_SETFL, fcntl(watch->wake[i], F_GETFL) | O_NONBLOCK);
+            fcntl(watch->wake[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch->fd == -1 || watch->wake[0] == -1) {
+        _ssr_watch_close(watch);
+        return false;
+    }
+    return true;
+}
+
+static void _ssr_watch_destroy(struct _ssr_watch_t* watch) {
+    _ssr_watch_close(watch);
+    for (int i = 0; i < 2; ++i) {
+        if (watch->wake[i] != -1) close(watch->wake[i]);
+        watch->wake[i] = -1;
+    }
+    size_t roots_len = _ssr_vec_len(&watch->roots);
+    for (size_t i = 0; i < roots_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&watch->roots, i));
+    _ssr_vec_destroy(&watch->roots);
+}
+
+// Out of watches everything is polled, the watch is closed
+static bool _ssr_watch_root(struct _ssr_watch_t* watch, const char* root) {
+    if (watch->fd == -1) return false;
+    _ssr_str_t path = _ssr_str(root);
+    _ssr_vec_push(&watch->roots, &path);
+    if (!_ssr_watch_add(watch, root, NULL, NULL)) {
+        _ssr_watch_close(watch);
+        return false;
+    }
+    return true;
+}
+
+// Removes the watches of dir and everything below it
+static void _ssr_watch_drop(struct _ssr_watch_t* watch, const char* dir) {
+    _ssr_str_t gone     = _ssr_str(dir);
+    size_t     dirs_len = _ssr_vec_len(&watch->dirs);
+    for (size_t wd = 0; wd < dirs_len; ++wd) {
+        _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&watch->dirs, wd);
+        if (path->b == NULL || !_ssr_path_in(gone.b, path->b)) continue;
+
+        // IN_IGNORED finds the path already gone
+        inotify_rm_watch(watch->fd, (int) wd);
+        _ssr_str_destroy(*path);
+        *path = _ssr_str_e();
+    }
+    _ssr_str_destroy(gone);
+}
+
+// Directories are kept if they are also below another root
+static void _ssr_watch_unroot(struct _ssr_watch_t* watch, const char* root) {
+    size_t roots_len = _ssr_vec_len(&watch->roots);
+    for (size_t i = 0; i < roots_len; ++i) {
+        _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&watch->roots, i);
+        if (strcmp(path->b, root) == 0) {
+            _ssr_str_t removed = *path;
+            _ssr_vec_remove(&watch->roots, path);
+            _ssr_str_destroy(removed);
+            break;
+        }
+    }
+    if (watch->fd == -1) return;
+
+    roots_len       = _ssr_vec_len(&watch->roots);
+    size_t dirs_len = _ssr_vec_len(&watch->dirs);
+    for (size_t wd = 0; wd < dirs_len; ++wd) {
+        _ssr_str_t* dir = (_ssr_str_t*) _ssr_vec_at(&watch->dirs, wd);
+        if (dir->b == NULL || !_ssr_path_in(root, dir->b)) continue;
+
+        bool shared = false;
+        for (size_t i = 0; i < roots_len && !shared; ++i)
+            shared = _ssr_path_in(((_ssr_str_t*) _ssr_vec_at(&watch->roots, i))->b, dir->b);
+        if (shared) continue;
+
+        // IN_IGNORED finds the path already gone
+        inotify_rm_watch(watch->fd, (int) wd);
+        _ssr_str_destroy(*dir);
+        *dir = _ssr_str_e();
+    }
+}
+
+// Blocks until either something changed or _ssr_watch_wake() is called. Returns false if the
+// watch is not (or no longer) usable, in that case the caller has to poll.
+static bool
+_ssr_watch_wait(struct _ssr_watch_t* watch, int timeout_ms, _ssr_iter_dir_cb_t cb, void* args) {
+    if (watch->fd == -1) return false;
+
+    struct pollfd fds[2];
+    fds[0].fd     = watch->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd     = watch->wake[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, timeout_ms) == -1) return errno == EINTR;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    if (fds[1].revents & POLLIN)
+        while (read(watch->wake[0], buf, sizeof(buf)) > 0)
+            ;
+
+    ssize_t len;
+    while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+        const char* cur = buf;
+        while (cur < buf + len) {
+            const struct inotify_event* ev = (const struct inotify_event*) cur;
+            cur += sizeof(struct inotify_event) + ev->len;
+
+            // Events have been dropped, everything could have changed
+            if (ev->mask & IN_Q_OVERFLOW) {
+                size_t roots_len = _ssr_vec_len(&watch->roots);
+                for (size_t i = 0; i < roots_len; ++i)
+                    _ssr_iter_dir(((_ssr_str_t*) _ssr_vec_at(&watch->roots, i))->b, cb, args);
+                continue;
+            }
+
+            if (ev->wd < 0 || (size_t) ev->wd >= _ssr_vec_len(&watch->dirs)) continue;
+            _ssr_str_t* dir = (_ssr_str_t*) _ssr_vec_at(&watch->dirs, ev->wd);
+
+            // Directory is gone, the kernel already dropped the watch
+            if (ev->mask & IN_IGNORED) {
+                _ssr_str_destroy(*dir);
+                *dir = _ssr_str_e();
+                continue;
+            }
+            if (dir->b == NULL) continue;
+
+            // If the directory was moved inside the tree the paths have already been updated by
+            // the IN_MOVED_TO on the new parent, otherwise it left the tree together with its
+            // subdirectories, which get no IN_MOVE_SELF of their own
+            if (ev->mask & IN_MOVE_SELF) {
+                if (!_ssr_file_exists(dir->b)) _ssr_watch_drop(watch, dir->b);
+                continue;
+            }
+
+            if (ev->mask & IN_ISDIR) {
+                if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) && strcmp(ev->name, SSR_BIN_DIR) != 0) {
+                    char sub[PATH_MAX + 1];
+                    snprintf(sub, PATH_MAX + 1, "%s/%s", dir->b, ev->name);
+                    if (!_ssr_watch_add(watch, sub, cb, args)) {
+                        _ssr_watch_close(watch);
+                        return false;
+                    }
+                }
+                continue;
+            }
+
+            if (ev->mask & _SSR_WATCH_FILE_MASK) cb(args, dir->b, ev->name);
+        }
+    }
+    return true;
+}
+
+static void _ssr_watch_wake(struct _ssr_watch_t* watch) {
+    if (watch->wake[1] == -1) return;
+    char c = 0;
+    ssize_t ret = write(watch->wake[1], &c, 1);
+    (void) ret; // pipe full means a wake up is already pending
+}
+#endif
+
+// Splits cmd in place on whitespace, '...' and "..." group (quotes are dropped). There is no
+// shell, nothing else is interpreted.
+static void _ssr_split_args(char* cmd, _ssr_vec_t* argv) {
+    char* read  = cmd;
+    char* write = cmd;
+    while (*read != '\0') {
+        while (*read == ' ' || *read == '\t' || *read == '\n')
+            ++read;
+        if (*read == '\0') break;
+
+        char* arg = write;
+        char quote = '\0';
+        while (*read != '\0' && (quote != '\0' || (*read != ' ' && *read != '\t' && *read != '\n'))) {
+            if (quote == '\0' && (*read == '\'' || *read == '"'))
+                quote = *read++;
+            else if (*read == quote) {
+                quote = '\0';
+                ++read;
+            } else
+                *write++ = *read++;
+        }
+        if (*read != '\0') ++read;
+        *write++ = '\0';
+        _ssr_vec_push(argv, &arg);
+    }
+}
+
+// Returns the text read so far and clears buf, embedded '\0' (gcc emits them on newlines) are
+// replaced so that it is printable. The trailing newline is dropped.
+static _ssr_str_t _ssr_run_output(_ssr_vec_t* buf) {
+    size_t len = _ssr_vec_len(buf);
+    while (len > 0 && (*(char*) _ssr_vec_at(buf, len - 1) == '\n' ||
+                          *(char*) _ssr_vec_at(buf, len - 1) == '\0'))
+        --len;
+    if (len == 0) return _ssr_str_e();
+
+    _ssr_str_t ret;
+    ret.b = _ssr_alloc(len + 1);
+    memcpy(ret.b, buf->beg, len);
+    for (size_t i = 0; i < len; ++i)
+        if (ret.b[i] == '\0') ret.b[i] = ' ';
+    ret.b[len] = '\0';
+    return ret;
+}
+
+// posix_spawn doesn't copy the address space, important as the host process can be large and
+// compilers are launched from multiple threads. The exit code of the process is returned, -1
+// if it couldn't be launched or didn't exit normally.
 static int _ssr_run(char* cmd, _ssr_str_t* out, _ssr_str_t* err) {
-    char buf[SSR_COMPILER_BUF + 3];
-    memset(buf, 0, SSR_COMPILER_BUF + 3);
+    if (out != NULL) *out = _ssr_str_e();
+    if (err != NULL) *err = _ssr_str_e();
+
+    _ssr_str_t args = _ssr_str(cmd);
+    _ssr_vec_t argv;
+    _ssr_vec(&argv, sizeof(char*), 32);
+    _ssr_split_args(args.b, &argv);
+    char* argv_end = NULL;
+    _ssr_vec_push(&argv, &argv_end);
+    char** child_argv = (char**) argv.beg;
+
+    int ret_code = -1;
+    int open_fds = 2;
+    int pipes[2][2] = {{-1, -1}, {-1, -1}}; // stdout, stderr
+    _ssr_vec_t bufs[2];
+    _ssr_vec(&bufs[0], 1, SSR_COMPILER_BUF);
+    _ssr_vec(&bufs[1], 1, SSR_COMPILER_BUF);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (_ssr_vec_len(&argv) < 2) goto end;
+
+    // Other threads might be spawning too, children should only see their own pipes
+    for (int i = 0; i < 2; ++i) {
+        if (pipe(pipes[i]) != 0) goto end;
+        fcntl(pipes[i][0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipes[i][1], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_adddup2(&actions, pipes[i][1], i + 1);
+    }
+
+    pid_t pid;
+    if (posix_spawnp(&pid, child_argv[0], &actions, NULL, child_argv, environ) != 0) {
+        _ssr_log(SSR_CB_ERR, "Failed to launch %s", child_argv[0]);
+        goto end;
+    }
+    close(pipes[0][1]);
+    close(pipes[1][1]);
+    pipes[0][1] = pipes[1][1] = -1;
+
+    // Both have to be drained at the same time, the child blocks as soon as either is full
+    char chunk[SSR_COMPILER_BUF];
+    while (open_fds > 0) {
+        struct pollfd fds[2];
+        for (int i = 0; i < 2; ++i) {
+            fds[i].fd      = pipes[i][0];
+            fds[i].events  = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
 
-    FILE* pipe_out = popen(cmd, "r");
-    if (pipe_out == NULL) {
-        // TODO: Error
-        return 1;
+        for (int i = 0; i < 2; ++i) {
+            if (fds[i].revents == 0) continue;
+            ssize_t read_len = read(pipes[i][0], chunk, sizeof(chunk));
+            if (read_len > 0) {
+                _ssr_vec_push_n(&bufs[i], chunk, (size_t) read_len);
+            } else if (read_len == 0 || errno != EINTR) {
+                close(pipes[i][0]);
+                pipes[i][0] = -1; // ignored by poll
+                --open_fds;
+            }
+        }
     }
 
-    while (fgets(buf, SSR_COMPILER_BUF, pipe_out) != NULL)
+    int status;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
         ;
-    int ret_code = pclose(pipe_out);
+    ret_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 
-    if (WIFEXITED(ret_code))
-        ret_code = 0;
-    else
-        ret_code = WEXITSTATUS(ret_code);
+    if (out != NULL) *out = _ssr_run_output(&bufs[0]);
+    if (err != NULL) *err = _ssr_run_output(&bufs[1]);
 
-    // Gcc output sometimes contains '\0\0' on newlines, as the buffer is guaranteed
-    // to have '\0\0\0' at the end this is safe. Just replacing '\0\0' to make code printable
-    char* cur = buf;
-    while (*cur != '\0' || *(cur + 1) != '\0' || (*(cur + 2) != '\0')) {
-        if (*cur == '\0') *cur = ' ';
-        ++cur;
+end:
+    for (int i = 0; i < 2; ++i) {
+        if (pipes[i][0] != -1) close(pipes[i][0]);
+        if (pipes[i][1] != -1) close(pipes[i][1]);
+        _ssr_vec_destroy(&bufs[i]);
     }
-
-    if (buf[0] != '\0') *err = _ssr_str(buf);
+    posix_spawn_file_actions_destroy(&actions);
+    _ssr_vec_destroy(&argv);
+    _ssr_str_destroy(args);
     return ret_code;
 }
 
@@ -887,6 +2112,14 @@ static const char* _ssr_extract_rel(const char* base, const char* path) {
     return NULL;
 }
 
+#ifdef SSR_LIVE
+static bool _ssr_path_in(const char* root, const char* path) {
+    size_t len = strlen(root);
+    return strncmp(root, path, len) == 0 &&
+           (path[len] == '\0' || path[len] == '/' || path[len] == '\\');
+}
+#endif
+
 static const char* _ssr_extract_ext(const char* path) {
     const char* cur = path + strlen(path);
     while (*(--cur) != '.' && cur >= path)
@@ -901,7 +2134,7 @@ static _ssr_str_t _ssr_replace_seps(const char* str, char new_sep) {
     char* write         = buffer;
     while (*read != '\0') {
         if (*read == '\\' || *read == '/') {
-            if (write > buffer && *(buffer - 1) != new_sep) // Avoiding double separator
+            if (write > buffer && *(write - 1) != new_sep) // Avoiding double separator
             {
                 *(write++) = new_sep;
                 ++read;
@@ -916,11 +2149,124 @@ static _ssr_str_t _ssr_replace_seps(const char* str, char new_sep) {
     return no_ext_ret;
 }
 
+typedef struct __ssr_job_t {
+    _ssr_job_fn_t fn;
+    void* args;
+} _ssr_job_t;
+
+typedef struct __ssr_pool_t {
+    _ssr_thread_t* threads;
+    size_t num_threads;
+    _ssr_vec_t jobs; // _ssr_job_t, consumed from head
+    size_t head;
+    size_t busy; // jobs currently running
+    bool quit;
+    _ssr_lock_t lock;
+    _ssr_cond_t cond; // signaled on new jobs, completed jobs and quit
+} _ssr_pool_t;
+
+#ifdef _WIN32 // && _MSC_VER
+static DWORD WINAPI
+#else
+static void*
+#endif
+_ssr_pool_worker(void* args) {
+    _ssr_pool_t* pool = (_ssr_pool_t*) args;
+
+    _ssr_lock_acq(&pool->lock);
+    while (true) {
+        while (!pool->quit && pool->head == _ssr_vec_len(&pool->jobs))
+            _ssr_cond_wait(&pool->cond, &pool->lock);
+        if (pool->head == _ssr_vec_len(&pool->jobs)) break;
+
+        _ssr_job_t job = *(_ssr_job_t*) _ssr_vec_at(&pool->jobs, pool->head++);
+        if (pool->head == _ssr_vec_len(&pool->jobs)) {
+            _ssr_vec_clear(&pool->jobs);
+            pool->head = 0;
+        }
+        ++pool->busy;
+        _ssr_lock_rel(&pool->lock);
+
+        job.fn(job.args);
+
+        _ssr_lock_acq(&pool->lock);
+        --pool->busy;
+        _ssr_cond_wake(&pool->cond);
+    }
+    _ssr_lock_rel(&pool->lock);
+    return 0;
+}
+
+static bool _ssr_pool(_ssr_pool_t* pool, size_t num_threads) {
+    pool->threads     = NULL;
+    pool->num_threads = 0;
+    pool->head        = 0;
+    pool->busy        = 0;
+    pool->quit        = false;
+    _ssr_vec(&pool->jobs, sizeof(_ssr_job_t), 32);
+    _ssr_lock(&pool->lock);
+    _ssr_cond(&pool->cond);
+
+    if (!_ssr_pool_grow(pool, num_threads)) {
+        _ssr_pool_destroy(pool);
+        return false;
+    }
+    return true;
+}
+
+// Workers are never removed, returns false if none could be added
+static bool _ssr_pool_grow(_ssr_pool_t* pool, size_t num_threads) {
+    if (num_threads <= pool->num_threads) return true;
+    _ssr_thread_t* threads =
+        (_ssr_thread_t*) realloc(pool->threads, sizeof(_ssr_thread_t) * num_threads);
+    if (threads == NULL) return false;
+    pool->threads = threads;
+
+    size_t prev_threads = pool->num_threads;
+    for (size_t i = prev_threads; i < num_threads; ++i) {
+        if (!_ssr_thread(&pool->threads[i], (void*) _ssr_pool_worker, pool)) break;
+        ++pool->num_threads;
+    }
+    return pool->num_threads > prev_threads;
+}
+
+static void _ssr_pool_destroy(_ssr_pool_t* pool) {
+    _ssr_lock_acq(&pool->lock);
+    pool->quit = true;
+    _ssr_cond_wake(&pool->cond);
+    _ssr_lock_rel(&pool->lock);
+
+    for (size_t i = 0; i < pool->num_threads; ++i)
+        _ssr_thread_join(&pool->threads[i]);
+
+    free(pool->threads);
+    pool->threads     = NULL;
+    pool->num_threads = 0;
+    _ssr_vec_destroy(&pool->jobs);
+    _ssr_cond_destroy(&pool->cond);
+    _ssr_lock_destroy(&pool->lock);
+}
+
+static void _ssr_pool_push(_ssr_pool_t* pool, _ssr_job_fn_t fn, void* args) {
+    _ssr_job_t job;
+    job.fn   = fn;
+    job.args = args;
+
+    _ssr_lock_acq(&pool->lock);
+    _ssr_vec_push(&pool->jobs, &job);
+    _ssr_cond_wake(&pool->cond);
+    _ssr_lock_rel(&pool->lock);
+}
+
 // Needed for live/not live
 enum _SSR_COMPILE_STAGES {
     _SSR_COMPILE        = 1,
     _SSR_LINK           = 1 << 1,
-    _SSR_COMPILE_N_LINK = _SSR_COMPILE | _SSR_LINK
+    _SSR_COMPILE_N_LINK = _SSR_COMPILE | _SSR_LINK,
+    _SSR_PREPROCESS     = 1 << 2, // never combined with other stages, used for cache keys
+    _SSR_DEPS           = 1 << 3, // with _SSR_COMPILE, headers included are written to <out>.d
+    _SSR_ARCHIVE        = 1 << 4, // never combined, input are object files
+    _SSR_PCH            = 1 << 5, // with _SSR_COMPILE, input is a header precompiled into out
 };
 
 static void
@@ -929,9 +2275,9 @@ _ssr_merge_in(char* buf, size_t buf_len, const char* flag, char** args, size_t n
     // TODO: Could be done in a bette way ?
     size_t len = 0;
     for (size_t i = 0; i < num_args; ++i) {
-        size_t new_len = snprintf(NULL, 0, "%s%s%s", buf, flag, args[i]);
-        if (new_len > buf_len) break; // TODO: warn user that skipping define
-        len += snprintf(buf, buf_len, "%s%s%s", buf, flag, args[i]);
+        size_t arg_len = snprintf(NULL, 0, " %s%s", flag, args[i]);
+        if (len + arg_len >= buf_len) break; // TODO: warn user that skipping define
+        len += snprintf(buf + len, buf_len - len, " %s%s", flag, args[i]);
     }
 }
 
@@ -960,7 +2306,7 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
         const char* base = bases[config->msvc_ver];
         const char* arch = archs[config->target_arch];
 
-        char* fmt         = "\"%svcvarsall.bat\" %s";
+        const char* fmt   = "\"%svcvarsall.bat\" %s";
         size_t vcvars_len = snprintf(NULL, 0, fmt, base, arch);
         vcvars            = (char*) malloc(vcvars_len + 1);
         snprintf(vcvars, vcvars_len + 1, fmt, base, arch);
@@ -969,6 +2315,48 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
     // compile step
     _ssr_str_t compile_out = _ssr_str_e();
 
+    if (stages & _SSR_ARCHIVE) {
+        const char* fmt     = "%s > nul && lib.exe /NOLOGO /OUT:\"%s\" %s";
+        _ssr_str_t archive  = _ssr_str_f(fmt, vcvars, _out, input);
+        _ssr_log(SSR_CB_INFO, "Archiving %s ...", _out);
+
+        _ssr_str_t err;
+        ret = _ssr_run(archive.b, NULL, &err) == 0;
+        _ssr_str_destroy(archive);
+        if (err.b != NULL) _ssr_log(ret ? SSR_CB_WARN : SSR_CB_ERR, "%s", err.b);
+        _ssr_str_destroy(err);
+        goto end;
+    }
+
+    if (stages & _SSR_PREPROCESS) {
+        char defines[_SSR_ARGS_BUF_LEN];
+        _ssr_merge_in(defines, _SSR_ARGS_BUF_LEN, "/D", config->defines, config->num_defines);
+
+        char include_directories[_SSR_ARGS_BUF_LEN];
+        _ssr_merge_in(include_directories,
+            _SSR_ARGS_BUF_LEN,
+            "/I",
+            config->include_directories,
+            config->num_include_directories);
+
+        char prefix_headers[_SSR_ARGS_BUF_LEN];
+        _ssr_merge_in(prefix_headers,
+            _SSR_ARGS_BUF_LEN,
+            "/FI",
+            config->prefix_headers,
+            config->num_prefix_headers);
+
+        const char* fmt       = "%s > nul && cl.exe /nologo /EP /P %s %s %s /Fi\"%s\" \"%s\"";
+        _ssr_str_t preprocess = _ssr_str_f(
+            fmt, vcvars, defines, include_directories, prefix_headers, _out, input);
+
+        _ssr_str_t err;
+        ret = _ssr_run(preprocess.b, NULL, &err) == 0;
+        _ssr_str_destroy(preprocess);
+        _ssr_str_destroy(err);
+        goto end;
+    }
+
     if (stages & _SSR_COMPILE) {
         // defines
         char defines[_SSR_ARGS_BUF_LEN];
@@ -982,12 +2370,21 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
             config->include_directories,
             config->num_include_directories);
 
+        // forced includes, not precompiled
+        char prefix_headers[_SSR_ARGS_BUF_LEN];
+        _ssr_merge_in(prefix_headers,
+            _SSR_ARGS_BUF_LEN,
+            "/FI",
+            config->prefix_headers,
+            config->num_prefix_headers);
+
         // default flags
         const char* default_args = "/c /EHsc /nologo";
 
         // flags
         const char* gen_dbg = config->flags & SSR_FLAGS_GEN_DEBUG ? "/Zi" : "";
         const char* mt_lib  = ""; // config->flags & SSR_FLAGS_GEN_DEBUG ? "/Mtd" : "/Mt";
+        const char* lto     = config->flags & SSR_FLAGS_LTO ? "/GL" : "";
 
         // custom args
         const char* beg_args = config->compile_args_beg == NULL ? "" : config->compile_args_beg;
@@ -996,9 +2393,9 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
         // output just appending .obj at end of full path
         if (stages & _SSR_LINK) compile_out = _ssr_str_f("%s.obj", _out);
 
-        // vcvars - base - beg_args - default_flags - gen_dbg - mt_lib - compile_out - end_args -
-        // input files
-        char* fmt = "%s > nul && cl.exe %s %s %s %s %s /Fo\"%s\" %s \"%s\"";
+        // vcvars - base - beg_args - default_flags - gen_dbg - mt_lib - lto - defines -
+        // prefix_headers - compile_out - end_args - input files
+        const char* fmt = "%s > nul && cl.exe %s %s %s %s %s %s %s /Fo\"%s\" %s \"%s\"";
 
         _ssr_str_t compile = _ssr_str_f(fmt,
             vcvars,
@@ -1006,7 +2403,9 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
             default_args,
             gen_dbg,
             mt_lib,
+            lto,
             defines,
+            prefix_headers,
             stages & _SSR_LINK ? compile_out.b : _out,
             end_args,
             input);
@@ -1017,9 +2416,9 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
         _ssr_str_destroy(compile);
         if (err.b != NULL) {
             if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
+                _ssr_log(SSR_CB_WARN, "%s", err.b);
             else
-                _ssr_log(SSR_CB_ERR, err.b);
+                _ssr_log(SSR_CB_ERR, "%s", err.b);
         }
         _ssr_str_destroy(err);
 
@@ -1040,6 +2439,7 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
 
         // flags
         const char* gen_dbg = config->flags & SSR_FLAGS_GEN_DEBUG ? "/DEBUG" : "";
+        const char* lto     = config->flags & SSR_FLAGS_LTO ? "/LTCG" : "";
 
         // custom args
         const char* beg_args = config->link_args_beg == NULL ? "" : config->link_args_beg;
@@ -1054,14 +2454,16 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
 #endif
             ;
 
-        // vcvars - base - beg_args - default_flags - gen_dbg - target - _out - end_args - input
-        char* fmt = "%s > nul && link.exe %s %s %s %s /OUT:\"%s\" %s \"%s\" %s";
+        // vcvars - base - beg_args - default_flags - gen_dbg - lto - target - _out - end_args -
+        // input
+        const char* fmt = "%s > nul && link.exe %s %s %s %s %s /OUT:\"%s\" %s \"%s\" %s";
 
         _ssr_str_t link = _ssr_str_f(fmt,
             vcvars,
             beg_args,
             default_flags,
             gen_dbg,
+            lto,
             target,
             _out,
             end_args,
@@ -1074,9 +2476,9 @@ _ssr_compile_msvc(const char* input, ssr_config_t* config, const char* _out, int
         _ssr_str_destroy(link);
         if (err.b != NULL) {
             if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
+                _ssr_log(SSR_CB_WARN, "%s", err.b);
             else
-                _ssr_log(SSR_CB_ERR, err.b);
+                _ssr_log(SSR_CB_ERR, "%s", err.b);
         }
 
         if (!ret) goto end;
@@ -1092,214 +2494,667 @@ end:
 #if !defined SSR_CLANG_EXEC
 #define SSR_CLANG_EXEC "clang"
 #endif
-static bool
-_ssr_compile_clang(const char* input, ssr_config_t* config, const char* _out, int stages) {
-    bool ret               = false;
-    _ssr_str_t compile_out = _ssr_str_e();
-    if (stages & _SSR_COMPILE) {
-        compile_out = _ssr_str_f("%s.obj", _out);
-
-        // defines
-        char defines[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(defines, _SSR_ARGS_BUF_LEN, "-D", config->defines, config->num_defines);
+#if !defined SSR_GCC_EXEC
+#define SSR_GCC_EXEC "gcc"
+#endif
 
-        // include directories
-        char include_directories[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(include_directories,
-            _SSR_ARGS_BUF_LEN,
-            "-I",
-            config->include_directories,
-            config->num_include_directories);
+// Appends a single argument to the command line being built in args
+static void _ssr_args(_ssr_vec_t* args, const char* fmt, ...) {
+    va_list vargs, vargs_cp;
+    va_start(vargs, fmt);
+    va_copy(vargs_cp, vargs);
+    size_t len = vsnprintf(NULL, 0, fmt, vargs);
+    char* arg  = _ssr_alloc(len + 1);
+    vsnprintf(arg, len + 1, fmt, vargs_cp);
+    va_end(vargs_cp);
+    va_end(vargs);
+    arg[len] = ' ';
+    _ssr_vec_push_n(args, arg, len + 1);
+    _ssr_free(arg);
+}
 
-        const char* gen_dbg = config->flags & SSR_FLAGS_GEN_DEBUG ? "-g " : "";
-        const char* opt_lvl = config->flags & SSR_FLAGS_GEN_OPT2 ?
-            "-O2" :
-            (config->flags & SSR_FLAGS_GEN_OPT1 ? "-O1" : ""); // Are they actually the same as gcc?
+static void _ssr_args_n(_ssr_vec_t* args, const char* flag, char** vals, size_t num_vals) {
+    for (size_t i = 0; i < num_vals; ++i)
+        _ssr_args(args, "%s%s", flag, vals[i]);
+}
 
-#if defined(SSR_LINUX)
-        char* fmt = "%s -c -fPIC -o %s %s %s %s -o%s %s -lm 2>&1";
-#else
-        char* fmt = "%s -c -fPIC -o %s %s %s %s -o%s %s";
+// Runs `exec @<out>.rsp`, the arguments are written to the response file as the command line
+// would have them, quotes included. Unlike the command line there is no limit on its length.
+static int _ssr_run_rsp(const char* exec, const char* out, _ssr_vec_t* args, _ssr_str_t* err) {
+    *err           = _ssr_str_e();
+    _ssr_str_t rsp = _ssr_str_f("%s.rsp", out);
+    FILE* fp       = fopen(rsp.b, "wb");
+    int ret        = -1;
+    if (fp != NULL) {
+        size_t len = _ssr_vec_len(args);
+        for (size_t i = 0; i < len; ++i) {
+            char c = *(char*) _ssr_vec_at(args, i);
+#if defined(SSR_WIN)
+            if (c == '\\') fputc('\\', fp); // escape character in response files
 #endif
+            fputc(c, fp);
+        }
+        fclose(fp);
 
-        _ssr_str_t compile = _ssr_str_f(fmt,
-            SSR_CLANG_EXEC,
-            gen_dbg,
-            opt_lvl,
-            defines,
-            include_directories,
-            stages & _SSR_LINK ? compile_out.b : _out,
-            input);
-        _ssr_log(SSR_CB_INFO, "Compiling %s ...", input);
+        _ssr_str_t cmd = _ssr_str_f("%s @%s", exec, rsp.b);
+        ret            = _ssr_run(cmd.b, NULL, err);
+        _ssr_str_destroy(cmd);
+        remove(rsp.b);
+    } else {
+        _ssr_log(SSR_CB_ERR, "Failed to write %s", rsp.b);
+    }
+    _ssr_str_destroy(rsp);
+    return ret;
+}
+
+/* gcc and clang, lto are the flags LTO objects are compiled with. Compiling and linking is a
+   single invocation, the object is piped to the linker by the driver instead of being written
+   next to out.
+*/
+static bool _ssr_compile_gnu(const char* exec,
+    const char* lto,
+    const char* input,
+    ssr_config_t* config,
+    const char* _out,
+    int stages) {
+    bool ret = false;
+    if (stages & _SSR_ARCHIVE) {
+        remove(_out); // otherwise objects are added to the previous archive
+        _ssr_str_t archive = _ssr_str_f("%s rcs %s %s", SSR_AR_EXEC, _out, input);
+        _ssr_log(SSR_CB_INFO, "Archiving %s ...", _out);
 
         _ssr_str_t err;
-        int ret = _ssr_run(compile.b, NULL, &err) == 0;
-        _ssr_str_destroy(compile);
-        if (err.b != NULL) {
-            if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
-            else
-                _ssr_log(SSR_CB_ERR, err.b);
-        }
+        ret = _ssr_run(archive.b, NULL, &err) == 0;
+        _ssr_str_destroy(archive);
+        if (err.b != NULL) _ssr_log(ret ? SSR_CB_WARN : SSR_CB_ERR, "%s", err.b);
         _ssr_str_destroy(err);
-
-        if (!ret) goto end;
+        return ret;
     }
 
-    if (stages & _SSR_LINK) {
-        // link libraries
-        char link_directories[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(link_directories,
-            _SSR_ARGS_BUF_LEN,
-            "/DEFAULTLIB",
-            config->link_libraries,
-            config->num_link_libraries);
-
-#if defined(SSR_LINUX)
-        char* fmt = "%s -shared -lm -o %s %s -lm 2>&1";
-#else
-        char* fmt = "%s -shared -lm -o %s %s";
-#endif
+    _ssr_vec_t args;
+    _ssr_vec(&args, sizeof(char), 1024);
 
-        _ssr_str_t link =
-            _ssr_str_f(fmt, SSR_CLANG_EXEC, _out, stages & _SSR_COMPILE ? compile_out.b : input);
-        _ssr_log(SSR_CB_INFO, "Linking %s ...", input);
+    if (stages & _SSR_PREPROCESS) {
+        // No linemarkers, moving the tree around shouldn't invalidate the cache
+        _ssr_args(&args, "-E -P");
+        _ssr_args_n(&args, "-D", config->defines, config->num_defines);
+        _ssr_args_n(&args, "-I", config->include_directories, config->num_include_directories);
+        _ssr_args_n(&args, "-include ", config->prefix_headers, config->num_prefix_headers);
+        _ssr_args(&args, "-o %s %s", _out, input);
 
         _ssr_str_t err;
-        int ret = _ssr_run(link.b, NULL, &err) == 0;
-        _ssr_str_destroy(link);
-        if (err.b != NULL) {
-            if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
-            else
-                _ssr_log(SSR_CB_ERR, err.b);
-        }
+        ret = _ssr_run_rsp(exec, _out, &args, &err) == 0;
         _ssr_str_destroy(err);
+        _ssr_vec_destroy(&args);
+        return ret;
+    }
 
-        if (!ret) goto end;
+    const char* opt_lvl = config->flags & SSR_FLAGS_GEN_OPT2 ?
+        "-O2" :
+        (config->flags & SSR_FLAGS_GEN_OPT1 ? "-O1" : "");
+    const char* compile_beg = config->compile_args_beg == NULL ? "" : config->compile_args_beg;
+    const char* compile_end = config->compile_args_end == NULL ? "" : config->compile_args_end;
+    const char* link_beg    = config->link_args_beg == NULL ? "" : config->link_args_beg;
+    const char* link_end    = config->link_args_end == NULL ? "" : config->link_args_end;
+
+    if (stages & _SSR_COMPILE) {
+        bool link = (stages & _SSR_LINK) != 0;
+        _ssr_args(&args, link ? "-pipe -shared -fPIC" : "-c -fPIC");
+        _ssr_args(&args, "%s", compile_beg);
+        if (link) _ssr_args(&args, "%s", link_beg);
+        if (config->flags & SSR_FLAGS_GEN_DEBUG) _ssr_args(&args, "-g");
+        _ssr_args(&args, "%s", opt_lvl);
+        // Linked right away, there is no need for the object to be readable
+        if (config->flags & SSR_FLAGS_LTO) _ssr_args(&args, "%s", link ? "-flto" : lto);
+        _ssr_args_n(&args, "-D", config->defines, config->num_defines);
+        _ssr_args_n(&args, "-I", config->include_directories, config->num_include_directories);
+        // The precompiled header, if any, is picked up next to the first one. Warns if it can't
+        // be used, otherwise the headers would be parsed again without notice.
+        _ssr_args_n(&args, "-include ", config->prefix_headers, config->num_prefix_headers);
+        bool prefixed = config->num_prefix_headers > 0 && !(stages & _SSR_PCH);
+        if (prefixed) _ssr_args(&args, "-Winvalid-pch");
+        // System headers are left out, they are not expected to change
+        if (stages & _SSR_DEPS) _ssr_args(&args, "-MMD -MF %s.d", _out);
+        _ssr_args(&args, "-o %s", _out);
+        _ssr_args(&args, "%s", compile_end);
+        if (link) _ssr_args(&args, "%s", link_end);
+        _ssr_args(&args, "%s%s", stages & _SSR_PCH ? "-x c-header " : "", input);
+        _ssr_log(SSR_CB_INFO, "Compiling %s ...", input);
+    } else {
+        // Code is generated at link time with LTO
+        _ssr_args(&args, "-shared %s", link_beg);
+        if (config->flags & SSR_FLAGS_LTO) _ssr_args(&args, "-flto %s", opt_lvl);
+        _ssr_args(&args, "-o %s %s %s", _out, link_end, input);
+        _ssr_log(SSR_CB_INFO, "Linking %s ...", input);
     }
 
-    ret = true;
-end:
-    _ssr_str_destroy(compile_out);
+    if (stages & _SSR_LINK) {
+        _ssr_args_n(&args, "", config->link_libraries, config->num_link_libraries);
+#if defined(SSR_LINUX)
+        _ssr_args(&args, "-lm");
+#endif
+    }
+
+    _ssr_str_t err;
+    ret = _ssr_run_rsp(exec, _out, &args, &err) == 0;
+    if (err.b != NULL) _ssr_log(ret ? SSR_CB_WARN : SSR_CB_ERR, "%s", err.b);
+    _ssr_str_destroy(err);
+    _ssr_vec_destroy(&args);
     return ret;
 }
 
-#if !defined SSR_GCC_EXEC
-#define SSR_GCC_EXEC "gcc"
-#endif
-
 static bool
-_ssr_compile_gcc(const char* input, ssr_config_t* config, const char* _out, int stages) {
-    bool ret               = false;
-    _ssr_str_t compile_out = _ssr_str_e();
-    if (stages & _SSR_COMPILE) {
-        compile_out = _ssr_str_f("%s.obj", _out);
+_ssr_compile_clang(const char* input, ssr_config_t* config, const char* out, int stages) {
+    return _ssr_compile_gnu(SSR_CLANG_EXEC, "-flto", input, config, out, stages);
+}
 
-        // defines
-        char defines[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(defines, _SSR_ARGS_BUF_LEN, "-D", config->defines, config->num_defines);
+// Fat objects still have a symbol table, the registry is generated from it
+static bool
+_ssr_compile_gcc(const char* input, ssr_config_t* config, const char* out, int stages) {
+    return _ssr_compile_gnu(
+        SSR_GCC_EXEC, "-flto -ffat-lto-objects", input, config, out, stages);
+}
 
-        // include directories
-        char include_directories[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(include_directories,
-            _SSR_ARGS_BUF_LEN,
-            "-I",
-            config->include_directories,
-            config->num_include_directories);
+/* SSR_COMPILER_TCC, libtcc is loaded once by the first ssr_run() using it and never unloaded,
+   if it fails it's not tried again. Calls are serialized, libtcc up to 0.9.27 keeps its state in
+   globals.
+*/
+typedef struct __ssr_tcc_t {
+    _ssr_lib_t lib;
+    _ssr_lock_t lock;
+    void* (*new_state)(void);
+    void (*delete_state)(void*);
+    void (*set_error_func)(void*, void*, void (*)(void*, const char*));
+    void (*set_options)(void*, const char*);
+    int (*add_include_path)(void*, const char*);
+    void (*define_symbol)(void*, const char*, const char*);
+    int (*add_file)(void*, const char*);
+    int (*add_library)(void*, const char*);
+    int (*set_output_type)(void*, int);
+    int (*output_file)(void*, const char*);
+    int (*relocate)(void*, void*);
+    void* (*get_symbol)(void*, const char*);
+} _ssr_tcc_t;
+
+static _ssr_tcc_t _ssr_tcc;
+static _ssr_once_t _ssr_tcc_once = _SSR_ONCE_INIT;
+
+// libtcc.h
+#define _SSR_TCC_OUTPUT_MEMORY 1
+#define _SSR_TCC_OUTPUT_DLL 3
+#define _SSR_TCC_OUTPUT_OBJ 4
+#define _SSR_TCC_RELOCATE_AUTO ((void*) 1) // later versions take no argument and ignore it
+
+#define _SSR_TCC_FN(field, name) \
+    (*(void**) &_ssr_tcc.field = _ssr_lib_func_addr(&_ssr_tcc.lib, name)) != NULL
+
+// Errors are logged to the instance loading it
+static void _ssr_tcc_init(void) {
+    if (!_ssr_lib(&_ssr_tcc.lib, SSR_LIBTCC)) {
+        _ssr_log(SSR_CB_ERR, "Failed to load %s", SSR_LIBTCC);
+        _ssr_tcc.lib.h = NULL;
+        return;
+    }
 
-        const char* gen_dbg = config->flags & SSR_FLAGS_GEN_DEBUG ? "-g " : "";
-        const char* opt_lvl = config->flags & SSR_FLAGS_GEN_OPT2 ?
-            "-O2" :
-            (config->flags & SSR_FLAGS_GEN_OPT1 ? "-O1" : "");
+    bool ret = _SSR_TCC_FN(new_state, "tcc_new") && _SSR_TCC_FN(delete_state, "tcc_delete") &&
+               _SSR_TCC_FN(set_error_func, "tcc_set_error_func") &&
+               _SSR_TCC_FN(set_options, "tcc_set_options") &&
+               _SSR_TCC_FN(add_include_path, "tcc_add_include_path") &&
+               _SSR_TCC_FN(define_symbol, "tcc_define_symbol") &&
+               _SSR_TCC_FN(add_file, "tcc_add_file") &&
+               _SSR_TCC_FN(add_library, "tcc_add_library") &&
+               _SSR_TCC_FN(set_output_type, "tcc_set_output_type") &&
+               _SSR_TCC_FN(output_file, "tcc_output_file") &&
+               _SSR_TCC_FN(relocate, "tcc_relocate") &&
+               _SSR_TCC_FN(get_symbol, "tcc_get_symbol");
+    if (!ret) {
+        _ssr_log(SSR_CB_ERR, "%s is missing part of the libtcc API", SSR_LIBTCC);
+        _ssr_lib_destroy(&_ssr_tcc.lib);
+        _ssr_tcc.lib.h = NULL;
+        return;
+    }
+    _ssr_lock(&_ssr_tcc.lock);
+}
 
-#if defined(SSR_LINUX)
-        char* fmt = "%s -c -o %s %s %s %s -o %s %s -lm 2>&1";
-#else
-        char* fmt = "%s -c -o %s %s %s %s -o %s %s";
-#endif
+// Instances running on different threads might get here together
+static bool _ssr_tcc_load(void) {
+    _ssr_once(&_ssr_tcc_once, _ssr_tcc_init);
+    return _ssr_tcc.lib.h != NULL;
+}
 
-        _ssr_str_t compile = _ssr_str_f(fmt,
-            SSR_GCC_EXEC,
-            gen_dbg,
-            opt_lvl,
-            defines,
-            include_directories,
-            stages & _SSR_LINK ? compile_out.b : _out,
-            input);
-        _ssr_log(SSR_CB_INFO, "Compiling %s ...", input);
+static void _ssr_tcc_error(void* opaque, const char* msg) {
+    (void) opaque;
+    _ssr_log(strstr(msg, "warning") != NULL ? SSR_CB_WARN : SSR_CB_ERR, "%s", msg);
+}
 
-        _ssr_str_t err;
-        int ret = _ssr_run(compile.b, NULL, &err) == 0;
-        _ssr_str_destroy(compile);
-        if (err.b != NULL) {
-            if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
-            else
-                _ssr_log(SSR_CB_ERR, err.b);
+// Same options as the other backends, _ssr_tcc.lock is expected to be held
+static void* _ssr_tcc_state(ssr_config_t* config, int output_type) {
+    void* state = _ssr_tcc.new_state();
+    if (state == NULL) return NULL;
+    _ssr_tcc.set_error_func(state, NULL, _ssr_tcc_error);
+
+    if (config->flags & SSR_FLAGS_GEN_DEBUG) _ssr_tcc.set_options(state, "-g");
+    if (config->compile_args_beg != NULL) _ssr_tcc.set_options(state, config->compile_args_beg);
+    if (config->compile_args_end != NULL) _ssr_tcc.set_options(state, config->compile_args_end);
+    for (size_t i = 0; i < config->num_include_directories; ++i)
+        _ssr_tcc.add_include_path(state, config->include_directories[i]);
+    for (size_t i = 0; i < config->num_defines; ++i) {
+        // Quoted for the shell, e.g. SSR_SCRIPTID
+        _ssr_str_t define = _ssr_str(config->defines[i]);
+        char* name        = define.b;
+        size_t len        = strlen(name);
+        if (len >= 2 && (name[0] == '\'' || name[0] == '"') && name[len - 1] == name[0]) {
+            name[len - 1] = '\0';
+            ++name;
         }
-        _ssr_str_destroy(err);
-
-        if (!ret) goto end;
+        char* value = strchr(name, '=');
+        if (value != NULL) *(value++) = '\0';
+        _ssr_tcc.define_symbol(state, name, value);
+        _ssr_str_destroy(define);
+    }
+    for (size_t i = 0; i < config->num_prefix_headers; ++i) {
+        _ssr_str_t include = _ssr_str_f("-include \"%s\"", config->prefix_headers[i]);
+        _ssr_tcc.set_options(state, include.b);
+        _ssr_str_destroy(include);
     }
 
-    if (stages & _SSR_LINK) {
-        // link libraries
-        char link_directories[_SSR_ARGS_BUF_LEN];
-        _ssr_merge_in(link_directories,
-            _SSR_ARGS_BUF_LEN,
-            "/DEFAULTLIB",
-            config->link_libraries,
-            config->num_link_libraries);
+    _ssr_tcc.set_output_type(state, output_type);
+    return state;
+}
 
+static bool _ssr_tcc_link(void* state, ssr_config_t* config) {
+    bool ret = true;
+    for (size_t i = 0; i < config->num_link_libraries; ++i)
+        ret = ret && _ssr_tcc.add_file(state, config->link_libraries[i]) == 0;
 #if defined(SSR_LINUX)
-        char* fmt = "%s -shared -o %s %s -lm 2>&1";
-#else
-        char* fmt = "%s -shared -o %s %s";
+    ret = ret && _ssr_tcc.add_library(state, "m") == 0;
 #endif
+    return ret;
+}
 
-        _ssr_str_t link =
-            _ssr_str_f(fmt, SSR_GCC_EXEC, _out, stages & _SSR_COMPILE ? compile_out.b : input);
-        _ssr_log(SSR_CB_INFO, "Linking %s ...", input);
+// Objects and libraries are still written for release. There is no preprocessor output, builds
+// are not cached, and no archiver.
+static bool
+_ssr_compile_tcc(const char* input, ssr_config_t* config, const char* _out, int stages) {
+    if (stages & (_SSR_PREPROCESS | _SSR_ARCHIVE)) return false;
 
-        _ssr_str_t err;
-        int ret = _ssr_run(link.b, NULL, &err) == 0;
-        _ssr_str_destroy(link);
-        if (err.b != NULL) {
-            if (ret)
-                _ssr_log(SSR_CB_WARN, err.b);
-            else
-                _ssr_log(SSR_CB_ERR, err.b);
-        }
-        _ssr_str_destroy(err);
+    _ssr_lock_acq(&_ssr_tcc.lock);
+    bool ret    = false;
+    void* state = _ssr_tcc_state(
+        config, stages & _SSR_LINK ? _SSR_TCC_OUTPUT_DLL : _SSR_TCC_OUTPUT_OBJ);
+    if (state == NULL) goto end;
 
-        if (!ret) goto end;
+    if (stages & _SSR_COMPILE) {
+        _ssr_log(SSR_CB_INFO, "Compiling %s ...", input);
+        if (_ssr_tcc.add_file(state, input) != 0) goto end;
+    } else {
+        // Objects separated by spaces
+        _ssr_log(SSR_CB_INFO, "Linking %s ...", input);
+        _ssr_str_t objs = _ssr_str(input);
+        bool added      = true;
+        for (char* obj = strtok(objs.b, " "); obj != NULL && added; obj = strtok(NULL, " "))
+            added = _ssr_tcc.add_file(state, obj) == 0;
+        _ssr_str_destroy(objs);
+        if (!added) goto end;
     }
 
-    ret = true;
+    ret = (!(stages & _SSR_LINK) || _ssr_tcc_link(state, config)) &&
+          _ssr_tcc.output_file(state, _out) == 0;
+
 end:
-    _ssr_str_destroy(compile_out);
+    if (state != NULL) _ssr_tcc.delete_state(state);
+    _ssr_lock_rel(&_ssr_tcc.lock);
+    return ret;
+}
+
+// Compiled and relocated in memory, the state is the library
+static bool _ssr_load_tcc(const char* input, ssr_config_t* config, _ssr_lib_t* lib) {
+    _ssr_lock_acq(&_ssr_tcc.lock);
+    _ssr_log(SSR_CB_INFO, "Compiling %s in memory ...", input);
+    void* state = _ssr_tcc_state(config, _SSR_TCC_OUTPUT_MEMORY);
+    bool ret    = state != NULL && _ssr_tcc.add_file(state, input) == 0 &&
+               _ssr_tcc_link(state, config) &&
+               _ssr_tcc.relocate(state, _SSR_TCC_RELOCATE_AUTO) >= 0;
+    if (ret) {
+        lib->h   = state;
+        lib->mem = true;
+    } else if (state != NULL) {
+        _ssr_tcc.delete_state(state);
+    }
+    _ssr_lock_rel(&_ssr_tcc.lock);
+    return ret;
+}
+
+static void _ssr_tcc_delete(void* state) {
+    _ssr_lock_acq(&_ssr_tcc.lock);
+    _ssr_tcc.delete_state(state);
+    _ssr_lock_rel(&_ssr_tcc.lock);
+}
+
+static void* _ssr_tcc_symbol(void* state, const char* name) {
+    _ssr_lock_acq(&_ssr_tcc.lock);
+    void* ret = _ssr_tcc.get_symbol(state, name);
+    _ssr_lock_rel(&_ssr_tcc.lock);
     return ret;
 }
 
+// Compiler behind _ssr_compile(), indexed by SSR_COMPILER
+typedef struct __ssr_backend_t {
+    bool (*compile)(const char* input, ssr_config_t* config, const char* out, int stages);
+    // Compiles and links input straight into memory, NULL if the backend only writes files.
+    // Headers included are not tracked for these builds.
+    bool (*load)(const char* input, ssr_config_t* config, _ssr_lib_t* lib);
+    // Extension the compiler looks for next to a prefix header, NULL if they are always parsed
+    const char* pch_ext;
+} _ssr_backend_t;
+
+static const _ssr_backend_t _ssr_backends[] = {
+    {_ssr_compile_msvc, NULL, NULL},
+    {_ssr_compile_clang, NULL, "pch"},
+    {_ssr_compile_gcc, NULL, "gch"},
+    {_ssr_compile_tcc, _ssr_load_tcc, NULL},
+};
+
+static const _ssr_backend_t* _ssr_backend(ssr_config_t* config) {
+    if (config->compiler < 0 ||
+        (size_t) config->compiler >= sizeof(_ssr_backends) / sizeof(_ssr_backends[0]))
+        return NULL;
+    return _ssr_backends + config->compiler;
+}
+
 static bool _ssr_compile(const char* path, ssr_config_t* config, const char* out, int stages) {
+    const _ssr_backend_t* backend = _ssr_backend(config);
+    return backend != NULL && backend->compile(path, config, out, stages);
+}
+
+// Compiler identity, part of every cache key
+static _ssr_hash_t _ssr_toolchain(ssr_config_t* config) {
+    _ssr_hash_t ret = _ssr_hash(&config->compiler, sizeof(int), 0);
+    ret             = _ssr_hash(&config->target_arch, sizeof(int), ret);
+
+    _ssr_str_t version;
     switch (config->compiler) {
-    case SSR_COMPILER_MSVC:
-        return _ssr_compile_msvc(path, config, out, stages);
+    case SSR_COMPILER_MSVC: // the installation path is versioned
+        ret = _ssr_hash(&config->msvc_ver, sizeof(int), ret);
+        return _ssr_hash_str(config->msvc141_path, ret);
     case SSR_COMPILER_CLANG:
-        return _ssr_compile_clang(path, config, out, stages);
+        ret     = _ssr_hash_str(SSR_CLANG_EXEC, ret);
+        version = _ssr_str_f("%s --version", SSR_CLANG_EXEC);
+        break;
+    case SSR_COMPILER_TCC: // only the library, libtcc has no version
+        return _ssr_hash_str(SSR_LIBTCC, ret);
     case SSR_COMPILER_GCC:
-        return _ssr_compile_gcc(path, config, out, stages);
+    default:
+        ret     = _ssr_hash_str(SSR_GCC_EXEC, ret);
+        version = _ssr_str_f("%s --version", SSR_GCC_EXEC);
+        break;
     }
-    return true;
+
+    _ssr_str_t out = _ssr_str_e();
+    _ssr_str_t err = _ssr_str_e();
+    _ssr_run(version.b, &out, &err);
+    ret = _ssr_hash_str(out.b, ret);
+    ret = _ssr_hash_str(err.b, ret);
+    _ssr_str_destroy(out);
+    _ssr_str_destroy(err);
+    _ssr_str_destroy(version);
+    return ret;
+}
+
+static _ssr_hash_t _ssr_hash_args(char** args, size_t num_args, _ssr_hash_t seed) {
+    seed = _ssr_hash(&num_args, sizeof(size_t), seed);
+    for (size_t i = 0; i < num_args; ++i)
+        seed = _ssr_hash_str(args[i], seed);
+    return seed;
+}
+
+// Everything in the config that ends up on the command line of stages
+static _ssr_hash_t _ssr_hash_config(ssr_config_t* config, int stages, _ssr_hash_t seed) {
+    seed = _ssr_hash(&stages, sizeof(int), seed);
+    seed = _ssr_hash(&config->flags, sizeof(int), seed);
+    if (stages & _SSR_COMPILE) {
+        seed = _ssr_hash_str(config->compile_args_beg, seed);
+        seed = _ssr_hash_str(config->compile_args_end, seed);
+        seed = _ssr_hash_args(config->defines, config->num_defines, seed);
+        seed = _ssr_hash_args(config->include_directories, config->num_include_directories, seed);
+        seed = _ssr_hash_args(config->prefix_headers, config->num_prefix_headers, seed);
+    }
+    if (stages & _SSR_LINK) {
+        seed = _ssr_hash_str(config->link_args_beg, seed);
+        seed = _ssr_hash_str(config->link_args_end, seed);
+        seed = _ssr_hash_args(config->link_libraries, config->num_link_libraries, seed);
+    }
+    return seed;
+}
+
+// Key of the artifact generated by running stages on input. The preprocessed source stands
+// for input and every header it includes.
+static bool _ssr_cache_key(const char* input,
+    ssr_config_t* config,
+    const char* bin,
+    _ssr_hash_t toolchain,
+    int stages,
+    _ssr_hash_t* key) {
+    _ssr_str_t rnd     = _ssr_str_uniq(SSR_SL_LEN);
+    _ssr_str_t pp_out  = _ssr_str_f("%s/%s.i", bin, rnd.b);
+    _ssr_hash_t hash   = toolchain;
+    bool ret = _ssr_compile(input, config, pp_out.b, _SSR_PREPROCESS) &&
+               _ssr_hash_file(pp_out.b, &hash);
+    remove(pp_out.b);
+    _ssr_str_destroy(pp_out);
+    _ssr_str_destroy(rnd);
+
+    if (ret) *key = _ssr_hash_config(config, stages, hash);
+    return ret;
+}
+
+#ifndef SSR_LIVE
+static _ssr_str_t _ssr_cache_path(const char* bin, _ssr_hash_t key, const char* ext) {
+    return _ssr_str_f("%s/cache/%016llx.%s", bin, (unsigned long long) key, ext);
+}
+#endif
+
+// Only invokes the compiler if the artifact is not in the cache already. The output is
+// moved in place once complete, a crash while compiling never leaves a truncated artifact.
+static bool
+_ssr_cache_build(const char* input, ssr_config_t* config, const char* out, int stages, bool* hit) {
+    *hit = _ssr_file_exists(out);
+    if (*hit) return true;
+
+    _ssr_str_t rnd     = _ssr_str_uniq(SSR_SL_LEN);
+    _ssr_str_t tmp_out = _ssr_str_f("%s.%s", out, rnd.b);
+    bool ret           = _ssr_compile(input, config, tmp_out.b, stages);
+    if (ret && rename(tmp_out.b, out) != 0) ret = _ssr_file_exists(out); // lost the race
+    remove(tmp_out.b);
+    if (stages & _SSR_DEPS) {
+        _ssr_str_t tmp_deps = _ssr_str_f("%s.d", tmp_out.b);
+        _ssr_str_t deps     = _ssr_str_f("%s.d", out);
+        if (!ret || rename(tmp_deps.b, deps.b) != 0) remove(tmp_deps.b);
+        _ssr_str_destroy(deps);
+        _ssr_str_destroy(tmp_deps);
+    }
+    if ((stages & _SSR_COMPILE_N_LINK) == _SSR_COMPILE_N_LINK) {
+        _ssr_str_t tmp_obj = _ssr_str_f("%s.obj", tmp_out.b);
+        remove(tmp_obj.b);
+        _ssr_str_destroy(tmp_obj);
+    }
+    _ssr_str_destroy(tmp_out);
+    _ssr_str_destroy(rnd);
+    return ret;
+}
+
+// Prerequisites of the rule written by -MMD, the first one (the source itself) is skipped.
+// Paths are relative to the working directory of the compiler, they are made absolute.
+static void _ssr_parse_deps(const char* path, _ssr_vec_t* deps) {
+    size_t len;
+    const char* beg = (const char*) _ssr_file_map(path, &len);
+    if (beg == NULL) return;
+
+    const char* cur = beg;
+    const char* end = beg + len;
+
+    // Skipping the target, it might contain ':' itself
+    while (cur < end && !(*cur == ':' && (cur + 1 == end || cur[1] == ' ' || cur[1] == '\n')))
+        ++cur;
+    ++cur;
+
+    _ssr_vec_t dep;
+    _ssr_vec(&dep, sizeof(char), 256);
+    bool first = true;
+    while (cur < end && *cur != '\n') {
+        // Line continuations
+        if (*cur == '\\' && cur + 1 < end && (cur[1] == '\n' || cur[1] == '\r')) {
+            cur += cur[1] == '\r' ? 3 : 2;
+            continue;
+        }
+        if (*cur == ' ' || *cur == '\t' || *cur == '\r') {
+            ++cur;
+            continue;
+        }
+
+        // Spaces are escaped with '\', '$' is doubled
+        _ssr_vec_clear(&dep);
+        while (cur < end && *cur != ' ' && *cur != '\t' && *cur != '\n' && *cur != '\r') {
+            if (*cur == '\\' && cur + 1 < end && (cur[1] == '\n' || cur[1] == '\r')) break;
+            if ((*cur == '\\' && cur + 1 < end && (cur[1] == ' ' || cur[1] == '#')) ||
+                (*cur == '$' && cur + 1 < end && cur[1] == '$'))
+                ++cur;
+            _ssr_vec_push(&dep, cur++);
+        }
+        char terminator = '\0';
+        _ssr_vec_push(&dep, &terminator);
+
+        if (first) {
+            first = false;
+            continue;
+        }
+        _ssr_str_t full_path = _ssr_fullpath((const char*) dep.beg);
+        if (full_path.b != NULL) _ssr_vec_push(deps, &full_path);
+    }
+
+    _ssr_vec_destroy(&dep);
+    _ssr_file_unmap(beg, len);
+}
+
+// Precompiles config->prefix_headers into <bin>/pch_<key>.h.<pch_ext>, keyed on everything
+// that ends up on the command line. It's rebuilt if any header it has been built from has been
+// written since. On success header is included by scripts instead of the prefix headers and
+// deps, if not NULL, receives what it has been built from. Not thread safe.
+static bool _ssr_pch(ssr_config_t* config,
+    const char* bin,
+    _ssr_hash_t toolchain,
+    _ssr_str_t* header,
+    _ssr_vec_t* deps) {
+    *header                       = _ssr_str_e();
+    const _ssr_backend_t* backend = _ssr_backend(config);
+    if (config->num_prefix_headers == 0 || backend == NULL || backend->pch_ext == NULL)
+        return false;
+
+    _ssr_hash_t key = _ssr_hash_config(config, _SSR_COMPILE, toolchain);
+    *header         = _ssr_str_f("%s/pch_%016llx.h", bin, (unsigned long long) key);
+    _ssr_str_t out  = _ssr_str_f("%s.%s", header->b, backend->pch_ext);
+    _ssr_str_t dmk  = _ssr_str_f("%s.d", out.b);
+
+    _ssr_vec_t built_from;
+    _ssr_vec(&built_from, sizeof(_ssr_str_t), 16);
+    _ssr_timestamp_t built = _ssr_file_timestamp(out.b);
+    bool ret               = false;
+    if (built != 0) {
+        _ssr_parse_deps(dmk.b, &built_from);
+        size_t len = _ssr_vec_len(&built_from);
+        ret        = len > 0;
+        for (size_t i = 0; i < len && ret; ++i) {
+            _ssr_str_t* dep     = (_ssr_str_t*) _ssr_vec_at(&built_from, i);
+            _ssr_timestamp_t ts = _ssr_file_timestamp(dep->b);
+            ret                 = ts != 0 && ts <= built;
+        }
+    }
+
+    if (!ret) {
+        for (size_t i = 0; i < _ssr_vec_len(&built_from); ++i)
+            _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&built_from, i));
+        _ssr_vec_clear(&built_from);
+
+        // Only one header can be precompiled, it includes all of them. It lives in bin, relative
+        // headers are resolved as the compiler would with -include, from the working directory
+        _ssr_vec_t text;
+        _ssr_vec(&text, sizeof(char), 256);
+        const char* banner = "// Generated by scriptosaurus.h, do not edit\n";
+        _ssr_vec_push_n(&text, banner, strlen(banner));
+        for (size_t i = 0; i < config->num_prefix_headers; ++i) {
+            _ssr_str_t full    = _ssr_fullpath(config->prefix_headers[i]);
+            _ssr_str_t include = _ssr_str_f("#include \"%s\"\n",
+                full.b != NULL ? full.b : config->prefix_headers[i]); // from include_directories
+            _ssr_vec_push_n(&text, include.b, strlen(include.b));
+            _ssr_str_destroy(include);
+            _ssr_str_destroy(full);
+        }
+
+        // Rewritten only if it changed, the header is one of its own dependencies
+        size_t text_len  = _ssr_vec_len(&text);
+        size_t prev_len  = 0;
+        const void* prev = _ssr_file_map(header->b, &prev_len);
+        bool same = prev != NULL && prev_len == text_len && memcmp(prev, text.beg, text_len) == 0;
+        if (prev != NULL) _ssr_file_unmap(prev, prev_len);
+        FILE* fp = same ? NULL : fopen(header->b, "wb");
+        if (fp != NULL) {
+            fwrite(text.beg, 1, text_len, fp);
+            fclose(fp);
+        }
+        _ssr_vec_destroy(&text);
+
+        ssr_config_t pch_config       = *config;
+        pch_config.num_prefix_headers = 0;
+        _ssr_log(SSR_CB_INFO, "Precompiling %s ...", header->b);
+
+        // Scripts still building keep reading the previous one
+        _ssr_str_t rnd     = _ssr_str_uniq(SSR_SL_LEN);
+        _ssr_str_t tmp_out = _ssr_str_f("%s.%s", out.b, rnd.b);
+        _ssr_str_t tmp_dmk = _ssr_str_f("%s.d", tmp_out.b);
+        int stages         = _SSR_COMPILE | _SSR_PCH | _SSR_DEPS;
+        ret = _ssr_compile(header->b, &pch_config, tmp_out.b, stages) &&
+              _ssr_file_replace(tmp_dmk.b, dmk.b) && _ssr_file_replace(tmp_out.b, out.b);
+        remove(tmp_out.b);
+        remove(tmp_dmk.b);
+        _ssr_str_destroy(tmp_dmk);
+        _ssr_str_destroy(tmp_out);
+        _ssr_str_destroy(rnd);
+
+        if (ret)
+            _ssr_parse_deps(dmk.b, &built_from);
+        else
+            _ssr_log(SSR_CB_WARN, "Failed to precompile %s, scripts parse the headers", header->b);
+    }
+
+    size_t len = _ssr_vec_len(&built_from);
+    for (size_t i = 0; i < len; ++i) {
+        _ssr_str_t* dep = (_ssr_str_t*) _ssr_vec_at(&built_from, i);
+        if (ret && deps != NULL)
+            _ssr_vec_push(deps, dep);
+        else
+            _ssr_str_destroy(*dep);
+    }
+    _ssr_vec_destroy(&built_from);
+    _ssr_str_destroy(dmk);
+    _ssr_str_destroy(out);
+    if (!ret) {
+        _ssr_str_destroy(*header);
+        *header = _ssr_str_e();
+    }
+    return ret;
 }
 
 // Internal
 typedef struct __ssr_routine_t {
-    _ssr_str_t name; // name of the function
+    _ssr_str_t name;  // name of the function
+    _ssr_hash_t hash; // of name, compared first
     void* addr;      // current pointer to function address
     _ssr_vec_t moos; // listeners
     _ssr_lock_t moos_lock;
+    uint32_t* gen;    // ssr_generation(), heap allocated as routines move around
+    ssr_slot_t* slot; // ssr_slot(), idx is the position in the script's routines
+    bool pinned;      // gen or slot have been handed out, they live until ssr_destroy()
+    uint32_t refs;    // listeners, plus one once pinned. Dropped at 0, name is then NULL.
 } _ssr_routine_t;
 
 // Element in dameon script map, indexed by script id (relative path with SSR_SEP)
@@ -1307,30 +3162,145 @@ typedef struct __ssr_script_t {
     _ssr_hash_t hash;
     _ssr_str_t id;
     _ssr_vec_t routines; // list of routines, could use a map, but not worth atm
-    clock_t last_seen;   // removal after X time, data stays in memory for a bit (Ctrl+Z friendly)
-    _ssr_timestamp_t last_written; // for updating
-    _ssr_str_t rnd_id;             // current id of the dll (also part of filename
+    uint32_t refs;       // routines with refs, only built and loaded while > 0
+    uint64_t last_seen;  // ms, last built or listened to, see _ssr_on_idle()
+    _ssr_file_info_t info;         // source as it was last handed to the compiler
+    _ssr_hash_t source_hash;       // and its content
+    _ssr_hash_t fingerprint;       // hash of the source lib has been built from
+    _ssr_str_t lib_path;           // current lib relative to bin, persisted in the index
     _ssr_lib_t lib;                // current lib lodaded in memory
+    uint32_t build_gen;            // last build handed to the pool
+    _ssr_vec_t deps;               // _ssr_str_t full paths of the headers lib has been built from
+    void*** table;    // ssr_slot_t::table, on its own cache line and not moving with the map
+    size_t table_len; // routines *table has been built for
+    unsigned int pgo_window_ms; // ssr_pgo(), 0 if not profiled
+    int pgo;                    // _SSR_PGO of the last build handed to the pool
+    uint32_t pgo_gen;           // build the instrumented library comes from, names its profile
+    uint64_t pgo_ms;            // when the instrumented library was published, 0 if not yet
+    int tier;                   // ssr_tier() of lib
+    _ssr_vec_t versions;        // _ssr_str_t superseded libraries relative to bin, oldest first
 } _ssr_script_t;
 
+enum _SSR_PGO {
+    _SSR_PGO_NONE,
+    _SSR_PGO_GENERATE, // instrumented, collecting the profile
+    _SSR_PGO_USE,      // optimized with the profile
+};
+
+// Element in the header map, indexed by full path
+typedef struct __ssr_header_t {
+    _ssr_hash_t hash;
+    _ssr_str_t path;
+    _ssr_vec_t scripts; // _ssr_str_t ids of the scripts including it
+    _ssr_file_info_t info;
+    _ssr_hash_t content;
+} _ssr_header_t;
+
+// Library replaced while registered threads might still be running it
+typedef struct __ssr_retired_t {
+    _ssr_lib_t lib; // h is NULL if only the table has been replaced
+    void** table;
+    uint32_t epoch;      // first epoch in which it's unreachable
+    _ssr_str_t id;       // script lib has been built from
+    _ssr_str_t lib_path; // relative to bin, joins the script's versions once unloaded
+} _ssr_retired_t;
+
+// File that changed, waiting for the writes to settle
+typedef struct __ssr_change_t {
+    _ssr_str_t id;
+    _ssr_str_t path;
+    _ssr_timestamp_t ts; // polling keeps reporting the same write
+    uint64_t last_ms;    // when it was last seen changing
+} _ssr_change_t;
+
 typedef struct ssr_t {
     ssr_config_t* config; // global config
     char* root;           // base directory (your scripts/ directory)
-    _ssr_thread_t thread; // daemon thread
     volatile uint32_t
         state; // for joining & keep track of wheter we generated a config or the user supplied one
 
     ssr_cb_t cb;
     int cb_mask;
 
+    ssr_stats_t stats;
+    _ssr_hash_t toolchain; // compiler identity for cache keys
+
 #ifdef SSR_LIVE
     _ssr_map_t scripts; // id -> _sso_script_t
-    const char* bin;
+    char* bin;
+    char* shm;           // SSR_FLAGS_SHM, libraries not cached are built here instead of bin
+    _ssr_lock_t lock;    // scripts & pending, shared between ssr_add() and the daemon
+    _ssr_vec_t pending;  // _ssr_str_t ids of scripts with new routines, drained by the daemon
+    bool index_dirty;    // a script has been rebuilt since the index was last saved
+    bool bin_dirty;      // a library has been written since bin was last trimmed
+    uint32_t build_gen;  // last build handed to the pool, across all scripts
+    _ssr_map_t headers;  // path -> _ssr_header_t, reverse dependencies
+    _ssr_vec_t unwatched; // _ssr_str_t headers seen for the first time, watched by the daemon
+    _ssr_vec_t threads;   // ssr_thread_t*, registered through ssr_thread_register()
+    _ssr_vec_t retired;   // _ssr_retired_t, unloaded by the daemon once no thread can be in them
+    uint32_t epoch;       // never 0, ssr_thread_t uses it for 'outside'
+    _ssr_vec_t profiling; // _ssr_str_t ids of scripts building or running instrumented
+    _ssr_lock_t pch_lock; // _ssr_pch(), workers share the precompiled headers
+    size_t jobs;          // builds queued or running on the pool, see _ssr_service_t
+    _ssr_cond_t idle;     // signaled as builds finish, ssr_destroy() waits for jobs to be 0
+
+    // Owned by the daemon
+    _ssr_vec_t changes; // _ssr_change_t
+    uint64_t first_change_ms;
+    uint64_t last_change_ms;
+    uint64_t idle_ms; // next _ssr_on_idle() pass
+    int watched;      // root in the service's watch, 0 until first served and -1 if polled
 #else
-    _ssr_lib_t lib; // single library when running 'release'
+    _ssr_lib_t lib;                 // single library when running 'release'
+    _ssr_vec_t slots;               // _ssr_static_slot_t*
+    const ssr_registry_t* registry; // NULL if functions have to be looked up in lib by name
 #endif
 } ssr_t;
 
+#if !defined(SSR_LIVE) && defined(SSR_STATIC_REGISTRY)
+extern const ssr_registry_t ssr$registry; // SSR_BIN_DIR/ssr.a, SSR_FLAGS_STATIC
+#endif
+
+#ifdef SSR_LIVE
+/* Live instances share a single daemon thread, watch and build pool, started by the first
+   ssr_run() and stopped by the last ssr_destroy(). The pool has as many workers as the largest
+   num_jobs, which caps concurrent builds across all instances. Instances can be run and
+   destroyed from any thread, starting and stopping the service is serialized by run_lock.
+*/
+typedef struct __ssr_service_t {
+    _ssr_lock_t run_lock;  // held by ssr_run() and ssr_destroy() while attaching or detaching
+    _ssr_lock_t wake_lock; // refs, nothing else is acquired while it's held
+    _ssr_lock_t lock;      // instances & unwatched, held by the daemon while serving them
+    _ssr_vec_t instances;  // ssr_t*, in the order they have been run
+    _ssr_vec_t unwatched;  // _ssr_str_t roots of destroyed instances, unwatched by the daemon
+    size_t refs;           // instances attached, the service is running while > 0
+    uint32_t quit;         // _ssr_load_u32() / _ssr_store_u32()
+    _ssr_thread_t thread;  // daemon
+    _ssr_watch_t watch;    // every root, and the directories of headers outside of them
+    _ssr_pool_t pool;      // builds of every instance, results are published by the workers
+} _ssr_service_t;
+
+static _ssr_service_t _ssr_service;
+static _ssr_once_t _ssr_service_once = _SSR_ONCE_INIT;
+
+// The locks outlive the service, they are never destroyed
+static void _ssr_service_init(void) {
+    _ssr_lock(&_ssr_service.run_lock);
+    _ssr_lock(&_ssr_service.wake_lock);
+}
+
+// Anything for the daemon to do, from any thread. The watch is only destroyed once refs is 0.
+static void _ssr_service_wake(void) {
+    _ssr_once(&_ssr_service_once, _ssr_service_init);
+    _ssr_lock_acq(&_ssr_service.wake_lock);
+    if (_ssr_service.refs > 0) _ssr_watch_wake(&_ssr_service.watch);
+    _ssr_lock_rel(&_ssr_service.wake_lock);
+}
+
+static void _ssr_index_save(ssr_t* ssr);
+static void _ssr_service_detach(ssr_t* ssr);
+#endif
+
 SSR_DEF bool ssr_init(struct ssr_t* ssr, const char* root, struct ssr_config_t* config) {
     memset(ssr, 0, sizeof(ssr_t));
     ssr->root  = _ssr_fullpath(root).b;
@@ -1338,10 +3308,23 @@ SSR_DEF bool ssr_init(struct ssr_t* ssr, const char* root, struct ssr_config_t*
 
 #ifdef SSR_LIVE
     _ssr_map(&ssr->scripts, sizeof(_ssr_script_t), 0);
+    _ssr_lock(&ssr->lock);
+    _ssr_lock(&ssr->pch_lock);
+    _ssr_cond(&ssr->idle);
+    _ssr_vec(&ssr->pending, sizeof(_ssr_str_t), 32);
+    _ssr_vec(&ssr->changes, sizeof(_ssr_change_t), 32);
+    _ssr_map(&ssr->headers, sizeof(_ssr_header_t), 0);
+    _ssr_vec(&ssr->unwatched, sizeof(_ssr_str_t), 32);
+    _ssr_vec(&ssr->threads, sizeof(ssr_thread_t*), 8);
+    _ssr_vec(&ssr->retired, sizeof(_ssr_retired_t), 8);
+    _ssr_vec(&ssr->profiling, sizeof(_ssr_str_t), 8);
+    ssr->epoch = 1;
+#else
+    _ssr_vec(&ssr->slots, sizeof(void*), 8);
 #endif
 
+    ssr->config = (ssr_config_t*) malloc(sizeof(ssr_config_t));
     if (config == NULL) {
-        ssr->config = (ssr_config_t*) malloc(sizeof(ssr_config_t));
 #if defined(__clang__)
         ssr->config->compiler = SSR_COMPILER_CLANG;
 #elif defined(__GNUC__) || defined(__GNUG__)
@@ -1368,12 +3351,19 @@ SSR_DEF bool ssr_init(struct ssr_t* ssr, const char* root, struct ssr_config_t*
 #error Unrecognized platform
 #endif
         ssr->config->flags                   = SSR_FLAGS_GEN_DEBUG;
+        ssr->config->num_jobs                = 0;
+        ssr->config->debounce_ms             = SSR_DEBOUNCE_MS;
+        ssr->config->keep_versions           = SSR_KEEP_VERSIONS;
+        ssr->config->bin_budget              = SSR_BIN_BUDGET;
+        ssr->config->evict_ms                = SSR_EVICT_MS;
         ssr->config->include_directories     = NULL;
         ssr->config->num_include_directories = 0;
         ssr->config->link_libraries          = NULL;
         ssr->config->num_link_libraries      = 0;
         ssr->config->defines                 = NULL;
         ssr->config->num_defines             = 0;
+        ssr->config->prefix_headers          = NULL;
+        ssr->config->num_prefix_headers      = 0;
         ssr->config->compile_args_beg        = NULL;
         ssr->config->compile_args_end        = NULL;
         ssr->config->link_args_beg           = NULL;
@@ -1384,7 +3374,7 @@ SSR_DEF bool ssr_init(struct ssr_t* ssr, const char* root, struct ssr_config_t*
     }
 
     if (ssr->config->compiler == SSR_COMPILER_MSVC && ssr->config->msvc_ver == SSR_MSVC_VER_14_1) {
-        const char* vswhere_cmd =
+        char vswhere_cmd[] =
             "C:/Program Files (x86)/Microsoft Visual Studio/Installer/vswhere.exe -property installationPath";
         _ssr_str_t output;
         _ssr_run(vswhere_cmd, &output, NULL);
@@ -1408,163 +3398,1644 @@ SSR_DEF bool ssr_init(struct ssr_t* ssr, const char* root, struct ssr_config_t*
     return true;
 }
 
+// Checks whether the file is of one of the SSR_FILE_EXTS
+static bool _ssr_script_ext(const char* filename) {
+    const char* exts[] = {SSR_FILE_EXTS};
+    const char* ext    = _ssr_extract_ext(filename);
+
+    for (size_t exti = 0; exts[exti][0] != '\0'; ++exti)
+        if (strcmp(exts[exti], ext) == 0) return true;
+    return false;
+}
+
+#ifdef SSR_LIVE
+static void _ssr_retired_destroy(_ssr_retired_t* retired) {
+    if (retired->lib.h != NULL) _ssr_lib_destroy(&retired->lib);
+    _ssr_aligned_free(retired->table);
+    _ssr_str_destroy(retired->id);
+    _ssr_str_destroy(retired->lib_path);
+}
+
+// Deletes a library built for a single script and whatever has been written next to it.
+// Cached libraries might be shared, they are only deleted by _ssr_trim().
+static void _ssr_version_remove(ssr_t* ssr, const char* lib_path) {
+    if (lib_path == NULL || strncmp(lib_path, "cache/", 6) == 0) return;
+    static const char* suffixes[] = {"", ".d", ".obj", ".rsp"};
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+        _ssr_str_t path = _ssr_str_f("%s/%s%s", ssr->bin, lib_path, suffixes[i]);
+        remove(path.b);
+        _ssr_str_destroy(path);
+    }
+}
+#endif
+
 static void _ssr_script_destroy(void* el, void* args) {
     _ssr_script_t* script = (_ssr_script_t*) el;
 
     size_t routines_len = _ssr_vec_len(&script->routines);
     for (size_t i = 0; i < routines_len; ++i) {
         _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
+        if (routine->name.b == NULL) continue; // dropped
         _ssr_str_destroy(routine->name);
         _ssr_vec_destroy(&routine->moos);
         _ssr_lock_destroy(&routine->moos_lock);
+        free(routine->gen);
+        free(routine->slot);
     }
+    _ssr_aligned_free(*script->table);
+    _ssr_aligned_free(script->table);
 
     _ssr_vec_destroy(&script->routines);
     _ssr_str_destroy(script->id);
-    _ssr_str_destroy(script->rnd_id);
+    _ssr_str_destroy(script->lib_path);
     _ssr_lib_destroy(&script->lib);
+
+    size_t deps_len = _ssr_vec_len(&script->deps);
+    for (size_t i = 0; i < deps_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&script->deps, i));
+    _ssr_vec_destroy(&script->deps);
+
+    size_t versions_len = _ssr_vec_len(&script->versions);
+    for (size_t i = 0; i < versions_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&script->versions, i));
+    _ssr_vec_destroy(&script->versions);
+}
+
+#ifdef SSR_LIVE
+static void _ssr_header_destroy(void* el, void* args) {
+    _ssr_header_t* header = (_ssr_header_t*) el;
+
+    size_t scripts_len = _ssr_vec_len(&header->scripts);
+    for (size_t i = 0; i < scripts_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&header->scripts, i));
+    _ssr_vec_destroy(&header->scripts);
+    _ssr_str_destroy(header->path);
 }
+#endif
 
 SSR_DEF void ssr_destroy(struct ssr_t* ssr) {
 #ifdef SSR_LIVE
+    _ssr_log(0, NULL, ssr);
     ssr->state |= 0x1;
-    _ssr_thread_join(&ssr->thread);
+    if (ssr->state & 0x4) _ssr_service_detach(ssr);
+
+    // Queued builds are skipped, the daemon is done with this instance
+    _ssr_lock_acq(&ssr->lock);
+    while (ssr->jobs > 0)
+        _ssr_cond_wait(&ssr->idle, &ssr->lock);
+    _ssr_lock_rel(&ssr->lock);
+    _ssr_index_save(ssr);
 #endif
 
     free(ssr->root);
-    if (ssr->state & 0x2) free(ssr->config);
+    free(ssr->config); // either generated (0x2) or a copy of the user's
 
 #ifdef SSR_LIVE
     _ssr_map_iter(&ssr->scripts, _ssr_script_destroy, NULL);
     _ssr_map_destroy(&ssr->scripts);
+    _ssr_map_iter(&ssr->headers, _ssr_header_destroy, NULL);
+    _ssr_map_destroy(&ssr->headers);
+
+    size_t unwatched_len = _ssr_vec_len(&ssr->unwatched);
+    for (size_t i = 0; i < unwatched_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&ssr->unwatched, i));
+    _ssr_vec_destroy(&ssr->unwatched);
+
+    size_t pending_len = _ssr_vec_len(&ssr->pending);
+    for (size_t i = 0; i < pending_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&ssr->pending, i));
+    _ssr_vec_destroy(&ssr->pending);
+
+    size_t profiling_len = _ssr_vec_len(&ssr->profiling);
+    for (size_t i = 0; i < profiling_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&ssr->profiling, i));
+    _ssr_vec_destroy(&ssr->profiling);
+
+    size_t changes_len = _ssr_vec_len(&ssr->changes);
+    for (size_t i = 0; i < changes_len; ++i) {
+        _ssr_change_t* change = (_ssr_change_t*) _ssr_vec_at(&ssr->changes, i);
+        _ssr_str_destroy(change->id);
+        _ssr_str_destroy(change->path);
+    }
+    _ssr_vec_destroy(&ssr->changes);
+
+    // Nothing is running scripts anymore
+    size_t retired_len = _ssr_vec_len(&ssr->retired);
+    for (size_t i = 0; i < retired_len; ++i)
+        _ssr_retired_destroy((_ssr_retired_t*) _ssr_vec_at(&ssr->retired, i));
+    _ssr_vec_destroy(&ssr->retired);
+
+    size_t threads_len = _ssr_vec_len(&ssr->threads);
+    for (size_t i = 0; i < threads_len; ++i)
+        free(*(ssr_thread_t**) _ssr_vec_at(&ssr->threads, i));
+    _ssr_vec_destroy(&ssr->threads);
+    _ssr_lock_destroy(&ssr->lock);
+    _ssr_lock_destroy(&ssr->pch_lock);
+    _ssr_cond_destroy(&ssr->idle);
+    free(ssr->bin);
+    if (ssr->shm != NULL) _ssr_remove_dir(ssr->shm); // libraries have been unlinked when loaded
+    free(ssr->shm);
 #else
     _ssr_lib_destroy(&ssr->lib);
+    size_t slots_len = _ssr_vec_len(&ssr->slots);
+    for (size_t i = 0; i < slots_len; ++i)
+        free(*(void**) _ssr_vec_at(&ssr->slots, i));
+    _ssr_vec_destroy(&ssr->slots);
 #endif
+    _ssr_log(0, NULL, NULL);
 }
 
 #ifdef SSR_LIVE
-static void _ssr_on_file(void* args, const char* base, const char* filename) {
+// Path of the script relative to root, reverting SSR_SEP. The first extension matching an
+// existing file wins, NULL if there is none.
+static _ssr_str_t _ssr_script_path(ssr_t* ssr, const char* id) {
     const char* exts[] = {SSR_FILE_EXTS};
-    ssr_t* ssr         = (ssr_t*) args;
-
-    // Extracting full path
-    _ssr_str_t full_path = _ssr_str_f("%s/%s", base, filename);
-    const char* ext      = _ssr_extract_ext(filename);
 
-    // Checking if file is of a valid extension
-    size_t exti = 0;
-    while (exts[exti][0] != '\0') {
-        if (strcmp(exts[exti], ext) == 0) break;
-        ++exti;
-    }
+    _ssr_str_t rel_id = _ssr_str(id);
+    for (char* c = rel_id.b; *c != '\0'; ++c)
+        if (*c == SSR_SEP) *c = '/';
 
-    // In case skipping file
-    if (exts[exti][0] == '\0') {
+    _ssr_str_t ret = _ssr_str_e();
+    for (size_t exti = 0; exts[exti][0] != '\0' && ret.b == NULL; ++exti) {
+        _ssr_str_t rel       = _ssr_str_f("%s%s", rel_id.b, exts[exti]);
+        _ssr_str_t full_path = _ssr_str_f("%s/%s", ssr->root, rel.b);
+        if (_ssr_file_exists(full_path.b))
+            ret = rel;
+        else
+            _ssr_str_destroy(rel);
         _ssr_str_destroy(full_path);
-        return;
     }
+    _ssr_str_destroy(rel_id);
+    return ret;
+}
 
-    // Computing script id
-    // |root|rel_path|filename
-    // |     base    |filename
-    // ptr is in base
-    const char* rel_path = _ssr_extract_rel(ssr->root, full_path.b);
-    _ssr_str_t id        = _ssr_replace_seps(rel_path, SSR_SEP);
-
-    _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id.b);
-
-    // new script, ssr has no permission to add scripts or routines, if script == NULL means
-    // that no one is registered to listen to this file, no need to go further
-    if (script == NULL || _ssr_vec_len(&script->routines) == 0) goto end;
+// Finds or inserts the script, hash is _ssr_hash_str() of the id. ssr->lock is expected to be
+// held
+static _ssr_script_t* _ssr_script_get_h(ssr_t* ssr, const char* id, _ssr_hash_t hash) {
+    _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find(&ssr->scripts, hash, id);
+    if (script != NULL) return script;
+
+    _ssr_script_t new_script;
+    memset(&new_script, 0, sizeof(_ssr_script_t));
+    _ssr_vec(&new_script.routines, sizeof(_ssr_routine_t), 32);
+    _ssr_vec(&new_script.deps, sizeof(_ssr_str_t), 8);
+    _ssr_vec(&new_script.versions, sizeof(_ssr_str_t), 4);
+    new_script.id        = _ssr_str(id);
+    new_script.table     = (void***) _ssr_aligned_alloc(_SSR_CACHE_LINE);
+    *new_script.table    = NULL;
+    new_script.last_seen = _ssr_now_ms();
+    return (_ssr_script_t*) _ssr_map_add(&ssr->scripts, &new_script, hash);
+}
 
-    _ssr_timestamp_t ts = _ssr_file_timestamp(full_path.b);
-    if (script->last_written < ts) {
-        // Generating name for the share library
-        _ssr_str_t _shared_lib_out = _ssr_str_rnd(SSR_SL_LEN);
-        while (_ssr_file_exists(_shared_lib_out.b)) {
-            _ssr_str_destroy(_shared_lib_out);
-            _shared_lib_out = _ssr_str_rnd(SSR_SL_LEN);
-        }
+static _ssr_script_t* _ssr_script_get(ssr_t* ssr, const char* id) {
+    return _ssr_script_get_h(ssr, id, _ssr_hash_str(id, 0));
+}
 
-        // Combining into full path
-        _ssr_str_t shared_lib_out =
-            _ssr_str_f("%s/%s.%s", ssr->bin, _shared_lib_out.b, _ssr_lib_ext());
+static _ssr_header_t* _ssr_header_find(ssr_t* ssr, const char* path) {
+    return (_ssr_header_t*) _ssr_map_find_str(&ssr->headers, path);
+}
 
-        // Time to compile and link into dll
-        bool compile_ret =
-            _ssr_compile(full_path.b, ssr->config, shared_lib_out.b, _SSR_COMPILE_N_LINK);
-        if (!compile_ret) {
-            _ssr_log(SSR_CB_ERR, "something went wrong"); // todo
+// Replaces the headers the script has been built from, updating the reverse index. Headers no
+// script includes anymore are dropped. deps is moved into the script, ssr->lock is expected to
+// be held.
+static void _ssr_script_deps(ssr_t* ssr, _ssr_script_t* script, _ssr_vec_t* deps) {
+    _ssr_vec_t prev_deps = script->deps;
+    size_t deps_len      = _ssr_vec_len(&prev_deps);
+    for (size_t i = 0; i < deps_len; ++i) {
+        _ssr_str_t* dep       = (_ssr_str_t*) _ssr_vec_at(&prev_deps, i);
+        _ssr_header_t* header = _ssr_header_find(ssr, dep->b);
+        size_t scripts_len    = header != NULL ? _ssr_vec_len(&header->scripts) : 0;
+        for (size_t j = 0; j < scripts_len; ++j) {
+            _ssr_str_t* id = (_ssr_str_t*) _ssr_vec_at(&header->scripts, j);
+            if (strcmp(id->b, script->id.b) == 0) {
+                _ssr_str_destroy(*id);
+                *id = *(_ssr_str_t*) _ssr_vec_at(&header->scripts, scripts_len - 1);
+                header->scripts.cur -= header->scripts.size;
+                break;
+            }
         }
-
-        // Loading library
-        _ssr_lib_t shared_lib;
-        if (!_ssr_lib(&shared_lib, shared_lib_out.b)) {
-            _ssr_str_destroy(_shared_lib_out);
-            _ssr_str_destroy(shared_lib_out);
-            goto end;
+    }
+    script->deps = *deps;
+
+    deps_len = _ssr_vec_len(&script->deps);
+    for (size_t i = 0; i < deps_len; ++i) {
+        _ssr_str_t* dep       = (_ssr_str_t*) _ssr_vec_at(&script->deps, i);
+        _ssr_header_t* header = _ssr_header_find(ssr, dep->b);
+        if (header == NULL) {
+            _ssr_header_t new_header;
+            new_header.path    = _ssr_str(dep->b);
+            new_header.content = 0;
+            _ssr_file_info(dep->b, &new_header.info);
+            _ssr_hash_file(dep->b, &new_header.content);
+            _ssr_vec(&new_header.scripts, sizeof(_ssr_str_t), 8);
+            header = (_ssr_header_t*) _ssr_map_add_str(&ssr->headers, &new_header);
+
+            _ssr_str_t unwatched = _ssr_str(dep->b);
+            _ssr_vec_push(&ssr->unwatched, &unwatched);
         }
 
-        // Updating map and all listeneres
-        _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id.b);
-        size_t routines_len   = _ssr_vec_len(&script->routines);
-        for (size_t i = 0; i < routines_len; ++i) {
-            _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
-
-            // Finding new function pointer
-            void* new_fptr = _ssr_lib_func_addr(&shared_lib, routine->name.b);
+        _ssr_str_t id = _ssr_str(script->id.b);
+        _ssr_vec_push(&header->scripts, &id);
+    }
 
-            _ssr_lock_acq(&routine->moos_lock);
-            size_t moos_len = _ssr_vec_len(&routine->moos);
-            for (size_t j = 0; j < moos_len; ++j) {
-                ssr_routine_t* user_routine = *(ssr_routine_t**) _ssr_vec_at(&routine->moos, j);
-                // Updating function pointer
-                *user_routine = new_fptr;
-            }
-            _ssr_lock_rel(&routine->moos_lock);
+    // Only after the new ones are in, headers still included are not hashed again
+    deps_len = _ssr_vec_len(&prev_deps);
+    for (size_t i = 0; i < deps_len; ++i) {
+        _ssr_str_t* dep       = (_ssr_str_t*) _ssr_vec_at(&prev_deps, i);
+        _ssr_header_t* header = _ssr_header_find(ssr, dep->b);
+        if (header != NULL && _ssr_vec_len(&header->scripts) == 0) {
+            _ssr_header_destroy(header, NULL);
+            _ssr_map_remove(&ssr->headers, header);
         }
-
-        // Can safely free library
-        _ssr_lib_destroy(&script->lib);
-        script->lib = shared_lib;
-
-        // rnd_id is saved for cleaning
-        _ssr_str_destroy(script->rnd_id);
-        script->rnd_id = _shared_lib_out;
-
-        script->last_written = ts;
-        _ssr_str_destroy(shared_lib_out);
+        _ssr_str_destroy(*dep);
     }
-    script->last_seen = clock();
+    _ssr_vec_destroy(&prev_deps);
+}
 
-    // The reason this is needed is because the compilation is triggered by a client-side call to
-    // ssr_add() which inserts a ssr_script and an ssr_routine inside the map. _ssr_on_file compiles
-    // the script and updates the listener. Any subsequent call to ssr_add inserts a new routine in
-    // the map, but the client-side **cannot** operate on ssr->lib as there is no lock.
+// Resolves every routine of the script from lib. Listeners are updated one by one, slots see
+// the whole script change at once through a new table. Generations are bumped last, whoever
+// sees them also sees the new addresses. Threads might still be running the previous
+// version, it's retired until they have all moved past the new epoch. ssr->lock is expected
+// to be held.
+static void _ssr_script_publish(ssr_t* ssr, _ssr_script_t* script, _ssr_lib_t lib) {
     size_t routines_len = _ssr_vec_len(&script->routines);
+    size_t table_size   = (routines_len > 0 ? routines_len : 1) * sizeof(void*);
+    table_size          = (table_size + _SSR_CACHE_LINE - 1) & ~(size_t) (_SSR_CACHE_LINE - 1);
+    void** table        = (void**) _ssr_aligned_alloc(table_size);
+
+    for (size_t i = 0; i < routines_len; ++i) {
+        _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
+        bool resolve            = lib.h != NULL && routine->name.b != NULL;
+        table[i] = resolve ? _ssr_lib_func_addr(&lib, routine->name.b) : NULL;
+        if (table[i] == routine->addr) continue;
+
+        routine->addr = table[i];
+        _ssr_lock_acq(&routine->moos_lock);
+        size_t moos_len = _ssr_vec_len(&routine->moos);
+        for (size_t j = 0; j < moos_len; ++j)
+            _ssr_store_ptr(*(void***) _ssr_vec_at(&routine->moos, j), routine->addr);
+        _ssr_lock_rel(&routine->moos_lock);
+    }
+
+    void** prev_table = *script->table;
+    size_t prev_len   = script->table_len;
+    bool new_lib      = lib.h != script->lib.h;
+    _ssr_store_ptr((void**) script->table, table);
+    script->table_len = routines_len;
+
+    if (prev_table != NULL || (new_lib && script->lib.h != NULL)) {
+        _ssr_retired_t retired;
+        memset(&retired, 0, sizeof(_ssr_retired_t));
+        if (new_lib) {
+            retired.lib      = script->lib;
+            retired.id       = _ssr_str(script->id.b);
+            retired.lib_path = script->lib_path;
+            script->lib_path = _ssr_str_e();
+        }
+        retired.table = prev_table;
+        retired.epoch = ssr->epoch + 1 != 0 ? ssr->epoch + 1 : 1;
+        _ssr_store_fence_u32(&ssr->epoch, retired.epoch);
+        _ssr_vec_push(&ssr->retired, &retired);
+    }
+    script->lib = lib;
+
     for (size_t i = 0; i < routines_len; ++i) {
         _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
-        void* addr              = routine->addr;
-        routine->addr           = _ssr_lib_func_addr(&script->lib, routine->name.b);
-        if (addr != routine->addr) {
-            void* new_fptr = _ssr_lib_func_addr(&script->lib, routine->name.b);
-
-            _ssr_lock_acq(&routine->moos_lock);
-            size_t moos_len = _ssr_vec_len(&routine->moos);
-            for (size_t j = 0; j < moos_len; ++j) {
-                ssr_routine_t* user_routine = *(ssr_routine_t**) _ssr_vec_at(&routine->moos, j);
-                // Updating function pointer
-                *user_routine = new_fptr;
+        void* prev              = prev_table != NULL && i < prev_len ? prev_table[i] : NULL;
+        if (routine->name.b == NULL) continue;
+        if (new_lib || table[i] != prev) _ssr_store_u32(routine->gen, *routine->gen + 1);
+    }
+}
+
+// NULL if the routine has never been added or has been dropped
+static _ssr_routine_t*
+_ssr_routine_find(_ssr_script_t* script, const char* fname, _ssr_hash_t hash) {
+    size_t routines_len = _ssr_vec_len(&script->routines);
+    for (size_t i = 0; i < routines_len; ++i) {
+        _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
+        if (routine->name.b == NULL || routine->hash != hash) continue;
+        if (strcmp(fname, routine->name.b) == 0) return routine;
+    }
+    return NULL;
+}
+
+// Finds or inserts the routine, the library is looked up right away if it's already loaded.
+// Otherwise the daemon only visits files that changed, letting it know a new routine is
+// waiting. The caller takes the first reference. ssr->lock is expected to be held.
+static _ssr_routine_t*
+_ssr_routine_get(ssr_t* ssr, _ssr_script_t* script, const char* fname, _ssr_hash_t hash) {
+    script->last_seen       = _ssr_now_ms();
+    _ssr_routine_t* routine = _ssr_routine_find(script, fname, hash);
+    if (routine != NULL) return routine;
+
+    // Positions of dropped routines are reused, slots index the table with them
+    size_t routines_len = _ssr_vec_len(&script->routines);
+    size_t idx          = 0;
+    while (idx < routines_len &&
+           ((_ssr_routine_t*) _ssr_vec_at(&script->routines, idx))->name.b != NULL)
+        ++idx;
+
+    _ssr_routine_t new_routine;
+    new_routine.name        = _ssr_str(fname);
+    new_routine.hash        = hash;
+    new_routine.addr        = NULL;
+    new_routine.pinned      = false;
+    new_routine.refs        = 0;
+    new_routine.gen         = (uint32_t*) malloc(sizeof(uint32_t));
+    *new_routine.gen        = 0;
+    new_routine.slot        = (ssr_slot_t*) malloc(sizeof(ssr_slot_t));
+    new_routine.slot->table = (void** const*) script->table;
+    new_routine.slot->idx   = idx;
+    _ssr_vec(&new_routine.moos, sizeof(void*), 32);
+    _ssr_lock(&new_routine.moos_lock);
+    if (idx < routines_len)
+        memcpy(_ssr_vec_at(&script->routines, idx), &new_routine, sizeof(_ssr_routine_t));
+    else
+        _ssr_vec_push(&script->routines, &new_routine);
+
+    // Slots have to be able to index the table even if the routine isn't there yet
+    if (script->lib.h != NULL) _ssr_script_publish(ssr, script, script->lib);
+
+    routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, idx);
+    if (routine->addr == NULL) {
+        _ssr_str_t id = _ssr_str(script->id.b);
+        _ssr_vec_push(&ssr->pending, &id);
+        _ssr_service_wake();
+    }
+    return routine;
+}
+
+// Routines are resolved to NULL, the library is retired and the source forgotten. lib_path,
+// fingerprint and tier are kept, if the source is still the same when the script is needed
+// again the library is loaded back by _ssr_build(). ssr->lock is expected to be held.
+static void _ssr_script_unload(ssr_t* ssr, _ssr_script_t* script) {
+    _ssr_lib_t lib;
+    memset(&lib, 0, sizeof(_ssr_lib_t));
+    _ssr_str_t lib_path = script->lib_path;
+    script->lib_path    = _ssr_str_e();
+    _ssr_script_publish(ssr, script, lib);
+    script->lib_path = lib_path;
+
+    _ssr_vec_t deps;
+    _ssr_vec(&deps, sizeof(_ssr_str_t), 8);
+    _ssr_script_deps(ssr, script, &deps);
+    memset(&script->info, 0, sizeof(_ssr_file_info_t));
+    script->source_hash = 0;
+    ssr->index_dirty    = true;
+}
+
+// Routines live as long as someone listens to them or they have been pinned, scripts as long
+// as one of their routines does. ssr->lock is expected to be held.
+static void _ssr_routine_ref(_ssr_script_t* script, _ssr_routine_t* routine) {
+    if (routine->refs++ == 0) ++script->refs;
+}
+
+// The last reference drops the routine, its position is left for the next one. A script
+// without routines is unloaded right away and evicted by _ssr_on_idle().
+static void _ssr_routine_unref(ssr_t* ssr, _ssr_script_t* script, _ssr_routine_t* routine) {
+    if (--routine->refs > 0) return;
+
+    _ssr_str_destroy(routine->name);
+    _ssr_vec_destroy(&routine->moos);
+    _ssr_lock_destroy(&routine->moos_lock);
+    free(routine->gen);
+    free(routine->slot);
+    memset(routine, 0, sizeof(_ssr_routine_t));
+
+    while (script->routines.cur > script->routines.beg) {
+        _ssr_routine_t* last = (_ssr_routine_t*) (script->routines.cur - script->routines.size);
+        if (last->name.b != NULL) break;
+        script->routines.cur -= script->routines.size;
+    }
+
+    script->last_seen = _ssr_now_ms();
+    if (--script->refs == 0) _ssr_script_unload(ssr, script);
+}
+
+// Rebuilding a script off the daemon thread, run on the pool
+typedef struct __ssr_build_job_t {
+    ssr_t* ssr;
+    _ssr_str_t id;
+    _ssr_str_t path;
+    uint32_t gen;            // builds finishing out of order are dropped
+    _ssr_hash_t fingerprint; // content of the source when the build was queued
+    int pgo;                 // _SSR_PGO
+    uint32_t pgo_gen;        // _SSR_PGO_USE, build the profile has been collected from
+    int tier;                // SSR_FLAGS_TIERED, 0 is followed by a build of tier 1
+} _ssr_build_job_t;
+
+// The profile is named after the object it has been compiled to, SSR_BIN_DIR/pgo/<id>.<gen>.
+// Ids have no directories in them, SSR_SEP took their place.
+static _ssr_str_t _ssr_pgo_path(ssr_t* ssr, const char* id, uint32_t gen, const char* ext) {
+    return _ssr_str_f("%s/pgo/%s.%u.%s", ssr->bin, id, gen, ext);
+}
+
+// Builds through a separate object in SSR_BIN_DIR/pgo, never cached as the profile is not
+// part of the key
+static bool
+_ssr_pgo_build(ssr_t* ssr, _ssr_build_job_t* job, const ssr_config_t* _config, const char* out) {
+    _ssr_str_t obj     = _ssr_pgo_path(ssr, job->id.b, job->gen, "obj");
+    _ssr_str_t profile = _ssr_pgo_path(ssr, job->id.b, job->gen, "gcda");
+    _ssr_str_t dump    = _ssr_str_f("%s/pgo/dump.h", ssr->bin);
+
+    ssr_config_t config = *_config;
+    const char* beg     = config.compile_args_beg != NULL ? config.compile_args_beg : "";
+    _ssr_str_t compile_args;
+    _ssr_str_t link_args;
+    if (job->pgo == _SSR_PGO_GENERATE) {
+        // Counters are shared with the threads running the script
+        compile_args = _ssr_str_f(
+            "-fprofile-generate -fprofile-update=prefer-atomic -include %s %s", dump.b, beg);
+        link_args = _ssr_str_f(
+            "-fprofile-generate %s", config.link_args_beg != NULL ? config.link_args_beg : "");
+        config.link_args_beg = link_args.b;
+    } else {
+        // The profile of the previous build is taken over, this object has the same name
+        _ssr_str_t prev = _ssr_pgo_path(ssr, job->id.b, job->pgo_gen, "gcda");
+        if (!_ssr_file_replace(prev.b, profile.b))
+            _ssr_log(SSR_CB_WARN, "No profile for %s, building without", job->path.b);
+        _ssr_str_destroy(prev);
+        compile_args = _ssr_str_f("-fprofile-use -fprofile-correction %s", beg);
+        link_args    = _ssr_str_e();
+    }
+    config.compile_args_beg = compile_args.b;
+
+    bool ret = _ssr_compile(job->path.b, &config, obj.b, _SSR_COMPILE | _SSR_DEPS) &&
+               _ssr_compile(obj.b, &config, out, _SSR_LINK);
+
+    // Dependencies are expected next to the library
+    _ssr_str_t obj_deps = _ssr_str_f("%s.d", obj.b);
+    _ssr_str_t deps     = _ssr_str_f("%s.d", out);
+    if (!ret || !_ssr_file_replace(obj_deps.b, deps.b)) remove(obj_deps.b);
+    remove(obj.b);
+
+    _ssr_str_destroy(deps);
+    _ssr_str_destroy(obj_deps);
+    _ssr_str_destroy(link_args);
+    _ssr_str_destroy(compile_args);
+    _ssr_str_destroy(dump);
+    _ssr_str_destroy(profile);
+    _ssr_str_destroy(obj);
+    return ret;
+}
+
+// Tier 0 drops all optimizations, tier 1 is built with -O2, plus -march=native with
+// SSR_FLAGS_NATIVE. args holds the compile args if they had to be changed.
+static void _ssr_tier_config(ssr_t* ssr, int tier, ssr_config_t* config, _ssr_str_t* args) {
+    *config = *ssr->config;
+    *args   = _ssr_str_e();
+    if (!(config->flags & SSR_FLAGS_TIERED)) return;
+
+    if (tier == 0) {
+        config->flags &= ~(SSR_FLAGS_GEN_OPT1 | SSR_FLAGS_GEN_OPT2 | SSR_FLAGS_LTO);
+    } else {
+        config->flags = (config->flags & ~SSR_FLAGS_GEN_OPT1) | SSR_FLAGS_GEN_OPT2;
+        if ((config->flags & SSR_FLAGS_NATIVE) && config->compiler != SSR_COMPILER_MSVC) {
+            *args = _ssr_str_f("-march=native %s",
+                config->compile_args_beg != NULL ? config->compile_args_beg : "");
+            config->compile_args_beg = args->b;
+        }
+    }
+}
+
+static void
+_ssr_build_push(ssr_t* ssr, _ssr_script_t* script, const char* path, int pgo, int tier);
+
+// Builds and publishes the library, nothing happens if the job has been superseded
+static void _ssr_build_publish(ssr_t* ssr, _ssr_build_job_t* job) {
+    // Superseded while waiting, e.g. tier 1 after a newer change
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* queued = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, job->id.b);
+    bool stale = queued == NULL || queued->build_gen != job->gen || queued->refs == 0;
+    _ssr_lock_rel(&ssr->lock);
+    if (stale) return;
+
+    _ssr_str_t _shared_lib_out = _ssr_str_e(); // relative to bin
+    _ssr_str_t shared_lib_out  = _ssr_str_e();
+    bool compile_ret;
+
+    ssr_config_t config;
+    _ssr_str_t config_args;
+    _ssr_tier_config(ssr, job->tier, &config, &config_args);
+
+    // Scripts don't see the headers behind a precompiled one, they are added to theirs
+    _ssr_vec_t pch_deps;
+    _ssr_vec(&pch_deps, sizeof(_ssr_str_t), 8);
+    _ssr_str_t pch;
+    _ssr_lock_acq(&ssr->pch_lock);
+    if (_ssr_pch(&config, ssr->bin, ssr->toolchain, &pch, &pch_deps)) {
+        config.prefix_headers     = &pch.b;
+        config.num_prefix_headers = 1;
+    }
+    _ssr_lock_rel(&ssr->pch_lock);
+
+    // In process backends skip the file system entirely, there is nothing to cache or index
+    _ssr_lib_t shared_lib;
+    const _ssr_backend_t* backend = _ssr_backend(&config);
+    bool mem = backend != NULL && backend->load != NULL && job->pgo == _SSR_PGO_NONE;
+
+    // Written to SSR_SHM_DIR unless cached
+    bool shm = !mem && ssr->shm != NULL;
+
+    _ssr_hash_t key;
+    if (mem) {
+        compile_ret = backend->load(job->path.b, &config, &shared_lib);
+    } else if (job->pgo == _SSR_PGO_NONE && (config.flags & SSR_FLAGS_CACHE) &&
+        _ssr_cache_key(
+            job->path.b, &config, ssr->bin, ssr->toolchain, _SSR_COMPILE_N_LINK, &key)) {
+        shm             = false;
+        _shared_lib_out = _ssr_str_f("cache/%016llx.%s", (unsigned long long) key, _ssr_lib_ext());
+        shared_lib_out  = _ssr_str_f("%s/%s", ssr->bin, _shared_lib_out.b);
+
+        bool hit;
+        compile_ret = _ssr_cache_build(
+            job->path.b, &config, shared_lib_out.b, _SSR_COMPILE_N_LINK | _SSR_DEPS, &hit);
+        _ssr_lock_acq(&ssr->lock);
+        if (hit)
+            ++ssr->stats.cache_hits;
+        else
+            ++ssr->stats.cache_misses;
+        _ssr_lock_rel(&ssr->lock);
+    } else {
+        // Generating name for the share library
+        const char* out_dir = shm ? ssr->shm : ssr->bin;
+        do {
+            _ssr_str_destroy(_shared_lib_out);
+            _ssr_str_destroy(shared_lib_out);
+            _ssr_str_t rnd  = _ssr_str_uniq(SSR_SL_LEN);
+            _shared_lib_out = _ssr_str_f("%s.%s", rnd.b, _ssr_lib_ext());
+            shared_lib_out  = _ssr_str_f("%s/%s", out_dir, _shared_lib_out.b);
+            _ssr_str_destroy(rnd);
+        } while (_ssr_file_exists(shared_lib_out.b));
+
+        // Gone once loaded, there is nothing to index
+        if (shm) {
+            _ssr_str_destroy(_shared_lib_out);
+            _shared_lib_out = _ssr_str_e();
+        }
+
+        // Time to compile and link into dll
+        if (job->pgo != _SSR_PGO_NONE)
+            compile_ret = _ssr_pgo_build(ssr, job, &config, shared_lib_out.b);
+        else
+            compile_ret = _ssr_compile(
+                job->path.b, &config, shared_lib_out.b, _SSR_COMPILE_N_LINK | _SSR_DEPS);
+    }
+    _ssr_str_destroy(config_args);
+    _ssr_str_destroy(pch);
+
+    // Loading library
+    bool loaded     = compile_ret && (mem || _ssr_lib(&shared_lib, shared_lib_out.b));
+    _ssr_vec_t deps = pch_deps;
+    if (!mem) {
+        _ssr_str_t deps_path = _ssr_str_f("%s.d", shared_lib_out.b);
+        if (loaded) _ssr_parse_deps(deps_path.b, &deps);
+
+        // The mapping stays until the library is unloaded, so does the memory
+        if (shm) {
+            remove(shared_lib_out.b);
+            remove(deps_path.b);
+        }
+        _ssr_str_destroy(deps_path);
+    }
+    _ssr_str_destroy(shared_lib_out);
+
+    if (!loaded) {
+        _ssr_log(SSR_CB_ERR, "Failed to build %s", job->path.b);
+        _ssr_version_remove(ssr, _shared_lib_out.b);
+        _ssr_str_destroy(_shared_lib_out);
+        size_t deps_len = _ssr_vec_len(&deps);
+        for (size_t i = 0; i < deps_len; ++i)
+            _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&deps, i));
+        _ssr_vec_destroy(&deps);
+        return;
+    }
+
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, job->id.b);
+    if (script == NULL || script->build_gen != job->gen || script->refs == 0) {
+        // A newer build has been started (or has already been published), or no one is left
+        _ssr_lock_rel(&ssr->lock);
+        _ssr_lib_destroy(&shared_lib);
+        if (job->pgo == _SSR_PGO_GENERATE) { // written when unloaded
+            _ssr_str_t profile = _ssr_pgo_path(ssr, job->id.b, job->gen, "gcda");
+            remove(profile.b);
+            _ssr_str_destroy(profile);
+        }
+        _ssr_version_remove(ssr, _shared_lib_out.b);
+        _ssr_str_destroy(_shared_lib_out);
+        size_t deps_len = _ssr_vec_len(&deps);
+        for (size_t i = 0; i < deps_len; ++i)
+            _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&deps, i));
+        _ssr_vec_destroy(&deps);
+        return;
+    }
+    _ssr_script_deps(ssr, script, &deps);
+
+    // Routines added after the library was loaded are resolved here too, the previous version
+    // is unloaded by the daemon
+    _ssr_script_publish(ssr, script, shared_lib);
+
+    // The previous lib_path has been retired with its library
+    _ssr_str_destroy(script->lib_path);
+    script->lib_path    = _shared_lib_out;
+    script->fingerprint = job->fingerprint;
+    ssr->index_dirty    = true;
+    ssr->bin_dirty      = true;
+
+    // The profiling window starts now
+    if (job->pgo == _SSR_PGO_GENERATE) {
+        script->pgo_gen = job->gen;
+        script->pgo_ms  = _ssr_now_ms();
+    }
+
+    // Same source, any change from now on cancels it
+    script->tier = job->tier;
+    if (job->tier == 0) _ssr_build_push(ssr, script, job->path.b, _SSR_PGO_NONE, 1);
+    _ssr_lock_rel(&ssr->lock);
+
+    // Index is saved by the daemon
+    _ssr_service_wake();
+}
+
+static void _ssr_build_job(void* args) {
+    _ssr_build_job_t* job = (_ssr_build_job_t*) args;
+    ssr_t* ssr            = job->ssr;
+    _ssr_log(0, NULL, ssr);
+    if (!(ssr->state & 0x1)) _ssr_build_publish(ssr, job); // skipped when shutting down
+
+    _ssr_str_destroy(job->id);
+    _ssr_str_destroy(job->path);
+    free(job);
+
+    _ssr_lock_acq(&ssr->lock);
+    --ssr->jobs;
+    _ssr_cond_wake(&ssr->idle);
+    _ssr_lock_rel(&ssr->lock);
+}
+
+// Queues a build of the source as it was last seen, ssr->lock is expected to be held
+static void
+_ssr_build_push(ssr_t* ssr, _ssr_script_t* script, const char* path, int pgo, int tier) {
+    _ssr_build_job_t* job = (_ssr_build_job_t*) malloc(sizeof(_ssr_build_job_t));
+    job->ssr              = ssr;
+    job->id               = _ssr_str(script->id.b);
+    job->path             = _ssr_str(path);
+    job->gen              = ++ssr->build_gen;
+    job->fingerprint      = script->source_hash;
+    job->pgo              = pgo;
+    job->pgo_gen          = script->pgo_gen;
+    job->tier             = tier;
+    script->build_gen     = job->gen;
+    ++ssr->jobs;
+    _ssr_pool_push(&_ssr_service.pool, _ssr_build_job, job);
+}
+
+// Loads back the library kept by _ssr_script_unload(), false if it's gone. Its headers are
+// read again from the dependency file. ssr->lock is expected to be held.
+static bool _ssr_script_reload(ssr_t* ssr, _ssr_script_t* script, const char* path) {
+    _ssr_str_t lib_full_path = _ssr_str_f("%s/%s", ssr->bin, script->lib_path.b);
+    _ssr_str_t deps_path     = _ssr_str_f("%s.d", lib_full_path.b);
+    _ssr_timestamp_t lib_ts  = _ssr_file_timestamp(lib_full_path.b);
+    _ssr_vec_t deps;
+    _ssr_vec(&deps, sizeof(_ssr_str_t), 8);
+    _ssr_parse_deps(deps_path.b, &deps);
+    _ssr_str_destroy(deps_path);
+
+    // Headers might have changed while it was unloaded
+    bool valid      = lib_ts != 0;
+    size_t deps_len = _ssr_vec_len(&deps);
+    for (size_t i = 0; i < deps_len && valid; ++i)
+        valid = _ssr_file_timestamp(((_ssr_str_t*) _ssr_vec_at(&deps, i))->b) <= lib_ts;
+
+    _ssr_lib_t lib;
+    if (!valid || !_ssr_lib(&lib, lib_full_path.b)) {
+        for (size_t i = 0; i < deps_len; ++i)
+            _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&deps, i));
+        _ssr_vec_destroy(&deps);
+        _ssr_str_destroy(lib_full_path);
+        return false;
+    }
+    _ssr_str_destroy(lib_full_path);
+    _ssr_script_deps(ssr, script, &deps);
+
+    _ssr_str_t lib_path = script->lib_path;
+    script->lib_path    = _ssr_str_e();
+    _ssr_script_publish(ssr, script, lib);
+    script->lib_path = lib_path;
+    ssr->index_dirty = true;
+    _ssr_log(SSR_CB_INFO, "Reloaded %s", script->id.b);
+
+    // Tiered build that never got promoted
+    if (script->tier == 0) _ssr_build_push(ssr, script, path, _SSR_PGO_NONE, 1);
+    return true;
+}
+
+// Hands the script to the pool, ssr->lock is expected to be held. Profiled scripts are built
+// instrumented unless pgo_use, which builds them with the profile of the running version.
+static void _ssr_build(ssr_t* ssr, _ssr_script_t* script, const char* path, bool pgo_use) {
+    int pgo = _SSR_PGO_NONE;
+    if (pgo_use) {
+        pgo = _SSR_PGO_USE;
+    } else if (script->pgo_window_ms > 0) {
+        pgo            = _SSR_PGO_GENERATE;
+        script->pgo_ms = 0;
+
+        bool profiling  = false;
+        size_t prof_len = _ssr_vec_len(&ssr->profiling);
+        for (size_t i = 0; i < prof_len && !profiling; ++i) {
+            _ssr_str_t* id = (_ssr_str_t*) _ssr_vec_at(&ssr->profiling, i);
+            profiling      = strcmp(id->b, script->id.b) == 0;
+        }
+        if (!profiling) {
+            _ssr_str_t id = _ssr_str(script->id.b);
+            _ssr_vec_push(&ssr->profiling, &id);
+        }
+    }
+    script->pgo = pgo;
+
+    // Whether it succeeds or not, this version of the file won't be built again. If the file
+    // changes while compiling the index is stale and not wrong.
+    _ssr_file_info(path, &script->info);
+    script->source_hash = 0;
+    _ssr_hash_file(path, &script->source_hash);
+    script->last_seen = _ssr_now_ms();
+
+    // Unloaded and needed again without changes
+    if (pgo == _SSR_PGO_NONE && script->lib.h == NULL && script->lib_path.b != NULL &&
+        script->source_hash == script->fingerprint && _ssr_script_reload(ssr, script, path))
+        return;
+
+    // Profiled builds are never tiered, they would measure the wrong version
+    bool tiered = (ssr->config->flags & SSR_FLAGS_TIERED) && pgo == _SSR_PGO_NONE;
+    _ssr_build_push(ssr, script, path, pgo, tiered ? 0 : 1);
+}
+
+// Adds the script to the changes or refreshes it if it is already there, ts is the write that
+// has been observed.
+static void
+_ssr_queue_change(ssr_t* ssr, const char* id, const char* path, _ssr_timestamp_t ts) {
+    uint64_t now          = _ssr_now_ms();
+    _ssr_change_t* change = NULL;
+    size_t changes_len    = _ssr_vec_len(&ssr->changes);
+    for (size_t i = 0; i < changes_len && change == NULL; ++i) {
+        _ssr_change_t* _change = (_ssr_change_t*) _ssr_vec_at(&ssr->changes, i);
+        if (strcmp(_change->id.b, id) == 0) change = _change;
+    }
+
+    if (change == NULL) {
+        _ssr_change_t new_change;
+        new_change.id      = _ssr_str(id);
+        new_change.path    = _ssr_str(path);
+        new_change.ts      = ts;
+        new_change.last_ms = now;
+        _ssr_vec_push(&ssr->changes, &new_change);
+        if (changes_len == 0) ssr->first_change_ms = now;
+        ssr->last_change_ms = now;
+    } else if (change->ts != ts) {
+        change->ts          = ts;
+        change->last_ms     = now;
+        ssr->last_change_ms = now;
+    }
+}
+
+// Scripts including a header that changed are queued as if they changed themselves
+static void _ssr_on_header(ssr_t* ssr, const char* path) {
+    _ssr_vec_t ids;
+    _ssr_vec(&ids, sizeof(_ssr_str_t), 8);
+
+    // Headers are small, confirming under the lock
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_header_t* header = _ssr_header_find(ssr, path);
+    _ssr_file_info_t info;
+    _ssr_hash_t content = 0;
+    if (header != NULL && _ssr_file_info(path, &info) &&
+        memcmp(&header->info, &info, sizeof(_ssr_file_info_t)) != 0) {
+        header->info = info;
+        if (_ssr_hash_file(path, &content) && content != header->content) {
+            header->content    = content;
+            size_t scripts_len = _ssr_vec_len(&header->scripts);
+            for (size_t i = 0; i < scripts_len; ++i) {
+                _ssr_str_t id = _ssr_str(((_ssr_str_t*) _ssr_vec_at(&header->scripts, i))->b);
+                _ssr_vec_push(&ids, &id);
             }
-            _ssr_lock_rel(&routine->moos_lock);
         }
     }
+    _ssr_lock_rel(&ssr->lock);
+
+    size_t ids_len = _ssr_vec_len(&ids);
+    for (size_t i = 0; i < ids_len; ++i) {
+        _ssr_str_t* id = (_ssr_str_t*) _ssr_vec_at(&ids, i);
+        _ssr_str_t rel = _ssr_script_path(ssr, id->b);
+        if (rel.b != NULL) {
+            _ssr_str_t full_path = _ssr_str_f("%s/%s", ssr->root, rel.b);
+            _ssr_queue_change(ssr, id->b, full_path.b, info.written);
+            _ssr_str_destroy(full_path);
+        }
+        _ssr_str_destroy(rel);
+        _ssr_str_destroy(*id);
+    }
+    _ssr_vec_destroy(&ids);
+}
+
+// Called on every file that might have changed, either by the watcher or by scanning root.
+// Changes are only queued here, see _ssr_on_changes()
+static void _ssr_on_change(void* args, const char* base, const char* filename) {
+    ssr_t* ssr = (ssr_t*) args;
+
+    _ssr_str_t full_path = _ssr_str_f("%s/%s", base, filename);
+    _ssr_on_header(ssr, full_path.b);
+
+    // In case skipping file
+    if (!_ssr_script_ext(filename)) {
+        _ssr_str_destroy(full_path);
+        return;
+    }
+
+    // Computing script id
+    // |root|rel_path|filename
+    // |     base    |filename
+    // ptr is in base
+    const char* rel_path = _ssr_extract_rel(ssr->root, full_path.b);
+    _ssr_str_t id        = _ssr_replace_seps(rel_path, SSR_SEP);
+    _ssr_file_info_t info;
+    bool exists = _ssr_file_info(full_path.b, &info);
+
+    // ssr has no permission to add scripts or routines, if script == NULL means that no one is
+    // registered to listen to this file. Otherwise it might have already been handed to the pool.
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id.b);
+    bool changed = exists && script != NULL && script->refs > 0 &&
+                   memcmp(&script->info, &info, sizeof(_ssr_file_info_t)) != 0;
+    _ssr_hash_t source_hash = changed ? script->source_hash : 0;
+    _ssr_lock_rel(&ssr->lock);
+
+    // Touched or saved without changes, only the signature is updated
+    _ssr_hash_t hash = 0;
+    if (changed && _ssr_hash_file(full_path.b, &hash) && hash == source_hash) {
+        _ssr_lock_acq(&ssr->lock);
+        script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id.b);
+        if (script != NULL) script->info = info;
+        _ssr_lock_rel(&ssr->lock);
+        changed = false;
+    }
+    if (changed) _ssr_queue_change(ssr, id.b, full_path.b, info.written);
 
-end:
     _ssr_str_destroy(full_path);
     _ssr_str_destroy(id);
 }
 
+static void _ssr_header_path(void* el, void* args) {
+    _ssr_str_t path = _ssr_str(((_ssr_header_t*) el)->path.b);
+    _ssr_vec_push((_ssr_vec_t*) args, &path);
+}
+
+// Without notifications headers outside of root would never be visited
+static void _ssr_poll_headers(ssr_t* ssr) {
+    _ssr_vec_t paths;
+    _ssr_vec(&paths, sizeof(_ssr_str_t), 32);
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_map_iter(&ssr->headers, _ssr_header_path, &paths);
+    _ssr_lock_rel(&ssr->lock);
+
+    size_t paths_len = _ssr_vec_len(&paths);
+    for (size_t i = 0; i < paths_len; ++i) {
+        _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&paths, i);
+        _ssr_on_header(ssr, path->b);
+        _ssr_str_destroy(*path);
+    }
+    _ssr_vec_destroy(&paths);
+}
+
+// Headers can live anywhere, their directories are watched as they are discovered. SSR_BIN_DIR
+// is never watched, it's written to by every build.
+static void _ssr_on_unwatched(ssr_t* ssr) {
+    _ssr_lock_acq(&ssr->lock);
+    size_t bin_len       = strlen(ssr->bin);
+    size_t unwatched_len = _ssr_vec_len(&ssr->unwatched);
+    for (size_t i = 0; i < unwatched_len; ++i) {
+        _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&ssr->unwatched, i);
+        char* sep        = strrchr(path->b, '/');
+        if (sep != NULL && strncmp(path->b, ssr->bin, bin_len) != 0) {
+            *sep = '\0';
+            _ssr_watch_dir(&_ssr_service.watch, path->b);
+        }
+        _ssr_str_destroy(*path);
+    }
+    _ssr_vec_clear(&ssr->unwatched);
+    _ssr_lock_rel(&ssr->lock);
+}
+
+// Queued changes are handed to the pool as a single batch once nothing has changed for
+// debounce_ms. If files keep changing the batch is held back for at most _SSR_DEBOUNCE_MAX
+// windows, files still being written to are then left for the next one.
+// Returns how long until it should be called again, -1 if nothing is queued.
+#define _SSR_DEBOUNCE_MAX 8
+
+static int _ssr_on_changes(ssr_t* ssr) {
+    size_t changes_len = _ssr_vec_len(&ssr->changes);
+    if (changes_len == 0) return -1;
+
+    uint64_t now      = _ssr_now_ms();
+    uint64_t debounce = ssr->config->debounce_ms > 0 ? ssr->config->debounce_ms : 0;
+    uint64_t quiet_at = ssr->last_change_ms + debounce;
+    uint64_t force_at = ssr->first_change_ms + debounce * _SSR_DEBOUNCE_MAX;
+    if (now < quiet_at && now < force_at)
+        return (int) ((quiet_at < force_at ? quiet_at : force_at) - now);
+
+    size_t kept  = 0;
+    size_t built = 0;
+    _ssr_lock_acq(&ssr->lock);
+    for (size_t i = 0; i < changes_len; ++i) {
+        _ssr_change_t* change = (_ssr_change_t*) _ssr_vec_at(&ssr->changes, i);
+        if (change->last_ms + debounce > now) {
+            memcpy(_ssr_vec_at(&ssr->changes, kept++), change, sizeof(_ssr_change_t));
+            continue;
+        }
+
+        _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, change->id.b);
+        if (script != NULL && script->refs > 0) {
+            _ssr_build(ssr, script, change->path.b, false);
+            ++built;
+        }
+        _ssr_str_destroy(change->id);
+        _ssr_str_destroy(change->path);
+    }
+    _ssr_lock_rel(&ssr->lock);
+    ssr->changes.cur = (uint8_t*) _ssr_vec_at(&ssr->changes, kept);
+
+    if (built > 1) _ssr_log(SSR_CB_INFO, "Building %d changed scripts", (int) built);
+    if (kept == 0) return -1;
+    ssr->first_change_ms = now;
+    return (int) debounce;
+}
+
+// Element in a set of paths
+typedef struct __ssr_path_t {
+    _ssr_hash_t hash;
+    _ssr_str_t path;
+} _ssr_path_t;
+
+static void _ssr_path_add(_ssr_map_t* paths, _ssr_str_t path) {
+    _ssr_path_t el;
+    el.path = path;
+    if (path.b != NULL && _ssr_map_find_str(paths, path.b) == NULL) _ssr_map_add_str(paths, &el);
+}
+
+static void _ssr_lib_path_cb(void* el, void* args) {
+    _ssr_path_add((_ssr_map_t*) args, ((_ssr_script_t*) el)->lib_path);
+}
+
+// Libraries still loaded, either by a script or waiting to be unloaded. Their names can't
+// be reused by a build, dlopen() would hand back the library already loaded. paths is a set
+// of _ssr_path_t pointing into the scripts, it's only valid while ssr->lock is held.
+static void _ssr_lib_paths(ssr_t* ssr, _ssr_map_t* paths) {
+    _ssr_map_iter(&ssr->scripts, _ssr_lib_path_cb, paths);
+    size_t retired_len = _ssr_vec_len(&ssr->retired);
+    for (size_t i = 0; i < retired_len; ++i)
+        _ssr_path_add(paths, ((_ssr_retired_t*) _ssr_vec_at(&ssr->retired, i))->lib_path);
+}
+
+// paths from _ssr_lib_paths()
+static bool _ssr_lib_path_used(_ssr_map_t* paths, const char* lib_path) {
+    return _ssr_map_find_str(paths, lib_path) != NULL;
+}
+
+static void _ssr_path_copy(void* el, void* args) {
+    (void) args;
+    ((_ssr_path_t*) el)->path = _ssr_str(((_ssr_path_t*) el)->path.b);
+}
+
+static void _ssr_path_destroy(void* el, void* args) {
+    (void) args;
+    _ssr_str_destroy(((_ssr_path_t*) el)->path);
+}
+
+// Superseded library that has been unloaded, only the last keep_versions of each script are
+// kept on disk. lib_path is moved, ssr->lock is expected to be held.
+static void _ssr_version_push(ssr_t* ssr, const char* id, _ssr_str_t lib_path) {
+    if (lib_path.b == NULL) return;
+    _ssr_script_t* script =
+        id != NULL ? (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id) : NULL;
+    if (script == NULL) {
+        _ssr_version_remove(ssr, lib_path.b);
+        _ssr_str_destroy(lib_path);
+        return;
+    }
+    _ssr_vec_push(&script->versions, &lib_path);
+
+    size_t keep         = ssr->config->keep_versions > 0 ? ssr->config->keep_versions : 0;
+    size_t versions_len = _ssr_vec_len(&script->versions);
+    if (versions_len <= keep) return;
+
+    // Trimmed versions leave their name free to be picked again by a later build
+    _ssr_map_t used;
+    _ssr_map(&used, sizeof(_ssr_path_t), 0);
+    _ssr_lib_paths(ssr, &used);
+    size_t drop = versions_len - keep;
+    for (size_t i = 0; i < drop; ++i) {
+        _ssr_str_t* version = (_ssr_str_t*) _ssr_vec_at(&script->versions, i);
+        if (!_ssr_lib_path_used(&used, version->b)) _ssr_version_remove(ssr, version->b);
+        _ssr_str_destroy(*version);
+    }
+    _ssr_map_destroy(&used);
+    memmove(script->versions.beg, _ssr_vec_at(&script->versions, drop), keep * sizeof(_ssr_str_t));
+    script->versions.cur = (uint8_t*) _ssr_vec_at(&script->versions, keep);
+}
+
+// Length of the library a file in bin belongs to if it's one built for a single script, e.g.
+// <rnd>.so and <rnd>.so.d. 0 otherwise.
+static size_t _ssr_version_name(const char* filename) {
+    for (size_t i = 0; i < SSR_SL_LEN; ++i)
+        if (filename[i] < 'a' || filename[i] > 'z') return 0;
+    if (filename[SSR_SL_LEN] != '.') return 0;
+
+    size_t ext_len = strlen(_ssr_lib_ext());
+    const char* ext = filename + SSR_SL_LEN + 1;
+    if (strncmp(ext, _ssr_lib_ext(), ext_len) != 0) return 0;
+    if (ext[ext_len] != '\0' && ext[ext_len] != '.') return 0;
+    return SSR_SL_LEN + 1 + ext_len;
+}
+
+typedef struct __ssr_trim_file_t {
+    _ssr_str_t path; // library, deleted along with whatever has been written next to it
+    _ssr_timestamp_t written;
+} _ssr_trim_file_t;
+
+typedef struct __ssr_trim_t {
+    ssr_t* ssr;
+    _ssr_map_t* used;  // _ssr_path_t lib_paths of the scripts
+    _ssr_map_t* stale; // _ssr_path_t libraries of previous runs, deleted right away. Or NULL.
+    _ssr_vec_t* files; // _ssr_trim_file_t
+    uint64_t total;    // bytes in bin
+} _ssr_trim_t;
+
+static void _ssr_trim_cb(void* args, const char* base, const char* filename) {
+    _ssr_trim_t* trim = (_ssr_trim_t*) args;
+    const char* bin   = trim->ssr->bin;
+    size_t bin_len    = strlen(bin);
+    _ssr_str_t path   = _ssr_str_f("%s/%s", base, filename);
+    _ssr_file_info_t info;
+    _ssr_file_info(path.b, &info);
+    trim->total += info.size;
+
+    // Either <rnd>.<ext> in bin or <key>.<ext> in bin/cache, with whatever is next to them
+    bool top      = strcmp(base, bin) == 0;
+    bool cached   = !top && strlen(base) > bin_len && strcmp(base + bin_len + 1, "cache") == 0;
+    size_t ext    = strlen(_ssr_lib_ext());
+    size_t name   = top ? _ssr_version_name(filename) : 0;
+    const char* e = cached ? strchr(filename, '.') : NULL;
+    if (e != NULL && strncmp(e + 1, _ssr_lib_ext(), ext) == 0 &&
+        (e[1 + ext] == '\0' || e[1 + ext] == '.'))
+        name = (size_t) (e - filename) + 1 + ext;
+
+    _ssr_str_t rel = _ssr_str_f("%s%.*s", cached ? "cache/" : "", (int) name, filename);
+    if (name == 0 || _ssr_lib_path_used(trim->used, rel.b)) {
+        _ssr_str_destroy(rel);
+        _ssr_str_destroy(path);
+        return;
+    }
+    bool stale = trim->stale != NULL && top && _ssr_map_find_str(trim->stale, rel.b) != NULL;
+    _ssr_str_destroy(rel);
+
+    if (stale) {
+        if (remove(path.b) == 0) trim->total -= info.size;
+    } else if (filename[name] == '\0') {
+        _ssr_trim_file_t file;
+        file.path    = path;
+        file.written = info.written;
+        _ssr_vec_push(trim->files, &file);
+        return;
+    }
+    _ssr_str_destroy(path);
+}
+
+static int _ssr_trim_cmp(const void* _a, const void* _b) {
+    const _ssr_trim_file_t* a = (const _ssr_trim_file_t*) _a;
+    const _ssr_trim_file_t* b = (const _ssr_trim_file_t*) _b;
+    return a->written < b->written ? -1 : (a->written > b->written ? 1 : 0);
+}
+
+// Deletes the oldest libraries in bin, superseded or cached, until it fits in bin_budget.
+// Libraries still loaded are never deleted. stale, from _ssr_index_load(), is swept first
+// before builds are started: libraries the index knows this bin left behind. Anything else
+// might be mapped by another process and is only deleted by age.
+static void _ssr_trim(ssr_t* ssr, _ssr_map_t* stale) {
+    // Libraries being built are not loaded yet, bin is left alone until they are
+    _ssr_lock_acq(&ssr->lock);
+    bool busy = ssr->jobs > 0;
+    _ssr_lock_rel(&ssr->lock);
+    if (stale == NULL && busy) return;
+
+    _ssr_lock_acq(&ssr->lock);
+    bool dirty     = ssr->bin_dirty || stale != NULL;
+    ssr->bin_dirty = false;
+    _ssr_map_t used;
+    _ssr_map(&used, sizeof(_ssr_path_t), 0);
+    if (dirty) _ssr_lib_paths(ssr, &used);
+
+    // lib_paths are only replaced by the workers under the lock, they are copied
+    _ssr_map_iter(&used, _ssr_path_copy, NULL);
+    _ssr_lock_rel(&ssr->lock);
+
+    _ssr_vec_t files;
+    _ssr_vec(&files, sizeof(_ssr_trim_file_t), 64);
+    if (dirty && (stale != NULL || ssr->config->bin_budget > 0)) {
+        _ssr_trim_t trim = {ssr, &used, stale, &files, 0};
+        _ssr_iter_dir(ssr->bin, _ssr_trim_cb, &trim);
+
+        size_t files_len = _ssr_vec_len(&files);
+        size_t budget    = ssr->config->bin_budget;
+        if (budget > 0 && trim.total > budget && files_len > 0) {
+            qsort(files.beg, files_len, sizeof(_ssr_trim_file_t), _ssr_trim_cmp);
+            static const char* suffixes[] = {"", ".d", ".obj", ".rsp"};
+            for (size_t i = 0; i < files_len && trim.total > budget; ++i) {
+                _ssr_trim_file_t* file = (_ssr_trim_file_t*) _ssr_vec_at(&files, i);
+                for (size_t j = 0; j < sizeof(suffixes) / sizeof(suffixes[0]); ++j) {
+                    _ssr_str_t path = _ssr_str_f("%s%s", file->path.b, suffixes[j]);
+                    _ssr_file_info_t info;
+                    if (_ssr_file_info(path.b, &info) && remove(path.b) == 0)
+                        trim.total -= info.size;
+                    _ssr_str_destroy(path);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < _ssr_vec_len(&files); ++i)
+        _ssr_str_destroy(((_ssr_trim_file_t*) _ssr_vec_at(&files, i))->path);
+    _ssr_vec_destroy(&files);
+    _ssr_map_iter(&used, _ssr_path_destroy, NULL);
+    _ssr_map_destroy(&used);
+}
+
+// Unloads the libraries no registered thread can be running anymore. Returns false if some
+// are still waiting.
+static bool _ssr_on_retired(ssr_t* ssr) {
+    _ssr_lock_acq(&ssr->lock);
+    size_t retired_len = _ssr_vec_len(&ssr->retired);
+    if (retired_len == 0) {
+        _ssr_lock_rel(&ssr->lock);
+        return true;
+    }
+
+    // Oldest epoch a thread inside script code might have loaded routines from
+    uint32_t oldest = _ssr_load_u32(&ssr->epoch);
+    size_t threads_len = _ssr_vec_len(&ssr->threads);
+    for (size_t i = 0; i < threads_len; ++i) {
+        ssr_thread_t* thread = *(ssr_thread_t**) _ssr_vec_at(&ssr->threads, i);
+        uint32_t epoch       = _ssr_load_u32(&thread->epoch);
+        if (epoch != 0 && (int32_t) (epoch - oldest) < 0) oldest = epoch;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < retired_len; ++i) {
+        _ssr_retired_t* retired = (_ssr_retired_t*) _ssr_vec_at(&ssr->retired, i);
+        if ((int32_t) (oldest - retired->epoch) >= 0) {
+            _ssr_str_t lib_path = retired->lib_path;
+            retired->lib_path   = _ssr_str_e();
+            _ssr_version_push(ssr, retired->id.b, lib_path);
+            _ssr_retired_destroy(retired);
+        } else
+            memmove(_ssr_vec_at(&ssr->retired, kept++), retired, sizeof(_ssr_retired_t));
+    }
+    ssr->retired.cur = (uint8_t*) _ssr_vec_at(&ssr->retired, kept);
+    _ssr_lock_rel(&ssr->lock);
+    return kept == 0;
+}
+
+// Scripts which received new routines through ssr_add() are built right away instead of
+// waiting for the source to change
+static void _ssr_on_pending(ssr_t* ssr) {
+    _ssr_lock_acq(&ssr->lock);
+    size_t pending_len = _ssr_vec_len(&ssr->pending);
+    for (size_t i = 0; i < pending_len; ++i) {
+        _ssr_str_t* id        = (_ssr_str_t*) _ssr_vec_at(&ssr->pending, i);
+        _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id->b);
+        _ssr_str_t path       = _ssr_script_path(ssr, id->b);
+        if (script != NULL && script->refs > 0 && path.b != NULL) {
+            _ssr_str_t full_path = _ssr_str_f("%s/%s", ssr->root, path.b);
+            _ssr_build(ssr, script, full_path.b, false);
+            _ssr_str_destroy(full_path);
+        }
+        _ssr_str_destroy(path);
+        _ssr_str_destroy(*id);
+    }
+    _ssr_vec_clear(&ssr->pending);
+    _ssr_lock_rel(&ssr->lock);
+}
+
+// Instrumented libraries write their profile once they have been running for the window, the
+// script is then rebuilt with it. Returns how long until it should be called again, -1 if no
+// window is running.
+static int _ssr_on_pgo(ssr_t* ssr) {
+    int ret = -1;
+    _ssr_lock_acq(&ssr->lock);
+    uint64_t now         = _ssr_now_ms();
+    size_t profiling_len = _ssr_vec_len(&ssr->profiling);
+    size_t kept          = 0;
+    for (size_t i = 0; i < profiling_len; ++i) {
+        _ssr_str_t* id        = (_ssr_str_t*) _ssr_vec_at(&ssr->profiling, i);
+        _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id->b);
+        if (script != NULL && script->pgo == _SSR_PGO_GENERATE &&
+            (script->pgo_ms == 0 || now < script->pgo_ms + script->pgo_window_ms)) {
+            // Still building or running, publishing the build wakes the daemon up
+            if (script->pgo_ms != 0) {
+                int left = (int) (script->pgo_ms + script->pgo_window_ms - now);
+                if (ret < 0 || left < ret) ret = left;
+            }
+            memmove(_ssr_vec_at(&ssr->profiling, kept++), id, sizeof(_ssr_str_t));
+            continue;
+        }
+
+        // __gcov_dump(), only the first call writes
+        if (script != NULL && script->pgo == _SSR_PGO_GENERATE) {
+            void (*dump)(void) =
+                (void (*)(void)) _ssr_lib_func_addr(&script->lib, "ssr$pgo$dump");
+            _ssr_str_t path = _ssr_script_path(ssr, id->b);
+            if (dump != NULL && path.b != NULL) {
+                dump();
+                _ssr_str_t full_path = _ssr_str_f("%s/%s", ssr->root, path.b);
+                _ssr_build(ssr, script, full_path.b, true);
+                _ssr_str_destroy(full_path);
+            } else {
+                _ssr_log(SSR_CB_WARN, "No profile has been collected for %s", id->b);
+            }
+            _ssr_str_destroy(path);
+        }
+        _ssr_str_destroy(*id);
+    }
+    ssr->profiling.cur = (uint8_t*) _ssr_vec_at(&ssr->profiling, kept);
+    _ssr_lock_rel(&ssr->lock);
+    return ret;
+}
+
+typedef struct __ssr_idle_t {
+    uint64_t now;
+    uint64_t evict_ms;
+    _ssr_vec_t ids; // _ssr_str_t
+} _ssr_idle_t;
+
+static void _ssr_idle_cb(void* el, void* args) {
+    _ssr_script_t* script = (_ssr_script_t*) el;
+    _ssr_idle_t* idle     = (_ssr_idle_t*) args;
+    if (script->last_seen + idle->evict_ms > idle->now) return;
+    _ssr_str_t id = _ssr_str(script->id.b);
+    _ssr_vec_push(&idle->ids, &id);
+}
+
+// Scripts no one has used for evict_ms are dropped with their library and entry in the map,
+// they are built again if they are added back (from the cache with SSR_FLAGS_CACHE).
+// Scripts still in use whose source has been deleted are unloaded instead, routines and slots
+// are NULL until it's back. Runs every evict_ms / 4, sources are checked every evict_ms.
+// Returns how long until it should be called again, -1 if nothing is ever evicted.
+static int _ssr_on_idle(ssr_t* ssr) {
+    uint64_t now = _ssr_now_ms();
+    if (ssr->config->evict_ms <= 0) return -1;
+    if (now < ssr->idle_ms) return (int) (ssr->idle_ms - now);
+    uint64_t evict_ms = (uint64_t) ssr->config->evict_ms;
+    ssr->idle_ms      = now + (evict_ms / 4 > 0 ? evict_ms / 4 : 1);
+
+    _ssr_idle_t idle;
+    idle.now      = now;
+    idle.evict_ms = evict_ms;
+    _ssr_vec(&idle.ids, sizeof(_ssr_str_t), 16);
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_map_iter(&ssr->scripts, _ssr_idle_cb, &idle);
+    _ssr_lock_rel(&ssr->lock);
+
+    size_t evicted  = 0;
+    size_t unloaded = 0;
+    size_t ids_len  = _ssr_vec_len(&idle.ids);
+    for (size_t i = 0; i < ids_len; ++i) {
+        _ssr_str_t* id   = (_ssr_str_t*) _ssr_vec_at(&idle.ids, i);
+        _ssr_str_t path  = _ssr_script_path(ssr, id->b);
+        bool deleted     = path.b == NULL;
+        _ssr_str_destroy(path);
+
+        // Might have been used while the source was looked for
+        _ssr_lock_acq(&ssr->lock);
+        _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, id->b);
+        if (script != NULL && script->last_seen + evict_ms <= now) {
+            if (script->refs == 0) {
+                _ssr_script_unload(ssr, script);
+
+                // Nothing can load the library back anymore, it's deleted once unloaded
+                _ssr_retired_t retired;
+                memset(&retired, 0, sizeof(_ssr_retired_t));
+                retired.epoch    = ssr->epoch;
+                retired.lib_path = script->lib_path;
+                script->lib_path = _ssr_str_e();
+                _ssr_vec_push(&ssr->retired, &retired);
+                _ssr_script_destroy(script, NULL);
+                _ssr_map_remove(&ssr->scripts, script);
+                ++evicted;
+            } else {
+                if (deleted && script->lib.h != NULL) {
+                    _ssr_script_unload(ssr, script);
+                    ++unloaded;
+                }
+                script->last_seen = now;
+            }
+        }
+        _ssr_lock_rel(&ssr->lock);
+        _ssr_str_destroy(*id);
+    }
+    _ssr_vec_destroy(&idle.ids);
+
+    if (evicted > 0) _ssr_log(SSR_CB_INFO, "Evicted %d idle scripts", (int) evicted);
+    if (unloaded > 0) _ssr_log(SSR_CB_INFO, "Unloaded %d deleted scripts", (int) unloaded);
+    return (int) (ssr->idle_ms - now);
+}
+
+/* SSR_BIN_DIR/index maps every loaded script to the library last built from it, so that after
+   a restart libraries whose source didn't change can be loaded right away. Layout:
+    uint32_t magic, uint32_t version, uint64_t config key, uint64_t count
+    count x {uint64_t fingerprint, uint32_t id_len, uint32_t lib_len,
+             char id[id_len], char lib_path[lib_len]}
+    uint64_t superseded, superseded x {uint32_t lib_len, char lib_path[lib_len]}
+   Strings are not terminated and nothing is aligned. Timestamps are too coarse to be trusted
+   across restarts, entries are validated against the content of the source. Superseded
+   libraries are the other ones built into bin, they are left behind for the next run to delete.
+*/
+#define _SSR_INDEX_MAGIC 0x49525353 // SSRI
+#define _SSR_INDEX_VERSION 2
+#define _SSR_INDEX_HEADER_LEN 24
+
+typedef struct __ssr_index_writer_t {
+    FILE* fp;
+    uint64_t count;
+    _ssr_vec_t superseded; // const char*
+} _ssr_index_writer_t;
+
+static void _ssr_index_save_script(void* el, void* args) {
+    _ssr_script_t* script     = (_ssr_script_t*) el;
+    _ssr_index_writer_t* writer = (_ssr_index_writer_t*) args;
+    size_t versions_len         = _ssr_vec_len(&script->versions);
+    for (size_t i = 0; i < versions_len; ++i)
+        _ssr_vec_push(&writer->superseded, &((_ssr_str_t*) _ssr_vec_at(&script->versions, i))->b);
+
+    if (script->lib_path.b == NULL) return;
+    if (script->lib.h == NULL || script->tier == 0) { // rebuilt on restart, it's not meant to stay
+        _ssr_vec_push(&writer->superseded, &script->lib_path.b);
+        return;
+    }
+
+    uint64_t fingerprint = script->fingerprint;
+    uint32_t id_len      = (uint32_t) strlen(script->id.b);
+    uint32_t lib_len     = (uint32_t) strlen(script->lib_path.b);
+    fwrite(&fingerprint, sizeof(uint64_t), 1, writer->fp);
+    fwrite(&id_len, sizeof(uint32_t), 1, writer->fp);
+    fwrite(&lib_len, sizeof(uint32_t), 1, writer->fp);
+    fwrite(script->id.b, 1, id_len, writer->fp);
+    fwrite(script->lib_path.b, 1, lib_len, writer->fp);
+    ++writer->count;
+}
+
+// Written next to the old one and moved in place, a crash never leaves a truncated index
+static void _ssr_index_save(ssr_t* ssr) {
+    _ssr_lock_acq(&ssr->lock);
+    bool dirty = ssr->index_dirty;
+    _ssr_lock_rel(&ssr->lock);
+    if (!dirty) return;
+
+    _ssr_str_t path     = _ssr_str_f("%s/index", ssr->bin);
+    _ssr_str_t tmp_path = _ssr_str_f("%s/index.tmp", ssr->bin);
+
+    _ssr_index_writer_t writer;
+    writer.count = 0;
+    writer.fp    = fopen(tmp_path.b, "wb");
+    _ssr_vec(&writer.superseded, sizeof(char*), 16);
+    if (writer.fp != NULL) {
+        uint32_t magic   = _SSR_INDEX_MAGIC;
+        uint32_t version = _SSR_INDEX_VERSION;
+        uint64_t key     = _ssr_hash_config(ssr->config, _SSR_COMPILE_N_LINK, ssr->toolchain);
+        fwrite(&magic, sizeof(uint32_t), 1, writer.fp);
+        fwrite(&version, sizeof(uint32_t), 1, writer.fp);
+        fwrite(&key, sizeof(uint64_t), 1, writer.fp);
+        fwrite(&writer.count, sizeof(uint64_t), 1, writer.fp);
+
+        _ssr_lock_acq(&ssr->lock);
+        _ssr_map_iter(&ssr->scripts, _ssr_index_save_script, &writer);
+        size_t retired_len = _ssr_vec_len(&ssr->retired);
+        for (size_t i = 0; i < retired_len; ++i) {
+            _ssr_retired_t* retired = (_ssr_retired_t*) _ssr_vec_at(&ssr->retired, i);
+            if (retired->lib_path.b != NULL)
+                _ssr_vec_push(&writer.superseded, &retired->lib_path.b);
+        }
+
+        uint64_t superseded_len = _ssr_vec_len(&writer.superseded);
+        fwrite(&superseded_len, sizeof(uint64_t), 1, writer.fp);
+        for (size_t i = 0; i < superseded_len; ++i) {
+            const char* lib_path = *(const char**) _ssr_vec_at(&writer.superseded, i);
+            uint32_t lib_len     = (uint32_t) strlen(lib_path);
+            fwrite(&lib_len, sizeof(uint32_t), 1, writer.fp);
+            fwrite(lib_path, 1, lib_len, writer.fp);
+        }
+        ssr->index_dirty = false;
+        _ssr_lock_rel(&ssr->lock);
+
+        fseek(writer.fp, _SSR_INDEX_HEADER_LEN - sizeof(uint64_t), SEEK_SET);
+        fwrite(&writer.count, sizeof(uint64_t), 1, writer.fp);
+        bool ret = fclose(writer.fp) == 0;
+        if (!ret || !_ssr_file_replace(tmp_path.b, path.b)) {
+            _ssr_log(SSR_CB_WARN, "Failed to save index %s", path.b);
+            remove(tmp_path.b);
+        }
+    }
+    _ssr_vec_destroy(&writer.superseded);
+
+    _ssr_str_destroy(tmp_path);
+    _ssr_str_destroy(path);
+}
+
+static void _ssr_index_stale(_ssr_map_t* stale, const uint8_t* lib_path, uint32_t lib_len) {
+    _ssr_path_t el;
+    el.path.b = _ssr_alloc(lib_len + 1);
+    memcpy(el.path.b, lib_path, lib_len);
+    el.path.b[lib_len] = '\0';
+    if (_ssr_map_find_str(stale, el.path.b) == NULL)
+        _ssr_map_add_str(stale, &el);
+    else
+        _ssr_str_destroy(el.path);
+}
+
+// Loads the libraries of all the scripts in the index that haven't changed since, entries
+// whose source changed are skipped and rebuilt as usual once someone listens to them. Their
+// libraries and the superseded ones are added to stale (owned _ssr_path_t), to be swept.
+static void _ssr_index_load(ssr_t* ssr, _ssr_map_t* stale) {
+    _ssr_str_t path = _ssr_str_f("%s/index", ssr->bin);
+    size_t len      = 0;
+    const uint8_t* beg = (const uint8_t*) _ssr_file_map(path.b, &len);
+    _ssr_str_destroy(path);
+    if (beg == NULL) return;
+
+    const uint8_t* cur = beg;
+    const uint8_t* end = beg + len;
+    uint32_t magic, version;
+    uint64_t key, count;
+    bool same_key;
+    size_t loaded = 0;
+    if (len < _SSR_INDEX_HEADER_LEN) goto end;
+    memcpy(&magic, cur, sizeof(uint32_t));
+    memcpy(&version, cur + 4, sizeof(uint32_t));
+    memcpy(&key, cur + 8, sizeof(uint64_t));
+    memcpy(&count, cur + 16, sizeof(uint64_t));
+    cur += _SSR_INDEX_HEADER_LEN;
+
+    if (magic != _SSR_INDEX_MAGIC || version != _SSR_INDEX_VERSION) goto end;
+
+    // Libraries built by a different compiler or with different options are all stale
+    same_key = key == _ssr_hash_config(ssr->config, _SSR_COMPILE_N_LINK, ssr->toolchain);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t fingerprint;
+        uint32_t id_len, lib_len;
+        if (end - cur < 16) goto end;
+        memcpy(&fingerprint, cur, sizeof(uint64_t));
+        memcpy(&id_len, cur + 8, sizeof(uint32_t));
+        memcpy(&lib_len, cur + 12, sizeof(uint32_t));
+        cur += 16;
+        if ((size_t) (end - cur) < (size_t) id_len + lib_len) goto end;
+        if (!same_key) {
+            _ssr_index_stale(stale, cur + id_len, lib_len);
+            cur += id_len + lib_len;
+            continue;
+        }
+
+        _ssr_str_t id;
+        id.b = _ssr_alloc(id_len + 1);
+        memcpy(id.b, cur, id_len);
+        id.b[id_len] = '\0';
+        _ssr_str_t lib_path;
+        lib_path.b = _ssr_alloc(lib_len + 1);
+        memcpy(lib_path.b, cur + id_len, lib_len);
+        lib_path.b[lib_len] = '\0';
+        cur += id_len + lib_len;
+
+        bool valid     = false;
+        _ssr_str_t rel = _ssr_script_path(ssr, id.b);
+        _ssr_file_info_t info;
+        if (rel.b != NULL) {
+            _ssr_str_t full_path = _ssr_str_f("%s/%s", ssr->root, rel.b);
+            _ssr_hash_t hash     = 0;
+            valid                = _ssr_file_info(full_path.b, &info) &&
+                    _ssr_hash_file(full_path.b, &hash) && hash == fingerprint;
+            _ssr_str_destroy(full_path);
+        }
+        _ssr_str_destroy(rel);
+
+        // Headers changed after the library was built make it stale as well
+        _ssr_str_t lib_full_path = _ssr_str_f("%s/%s", ssr->bin, lib_path.b);
+        _ssr_str_t deps_path     = _ssr_str_f("%s.d", lib_full_path.b);
+        _ssr_timestamp_t lib_ts  = _ssr_file_timestamp(lib_full_path.b);
+        _ssr_vec_t deps;
+        _ssr_vec(&deps, sizeof(_ssr_str_t), 8);
+        _ssr_parse_deps(deps_path.b, &deps);
+        size_t deps_len = _ssr_vec_len(&deps);
+        for (size_t j = 0; j < deps_len && valid; ++j)
+            valid = _ssr_file_timestamp(((_ssr_str_t*) _ssr_vec_at(&deps, j))->b) <= lib_ts;
+        _ssr_str_destroy(deps_path);
+
+        _ssr_lib_t lib;
+        if (valid && _ssr_lib(&lib, lib_full_path.b)) {
+            _ssr_script_t* script = _ssr_script_get(ssr, id.b);
+            _ssr_lib_destroy(&script->lib);
+            _ssr_str_destroy(script->lib_path);
+            script->lib         = lib;
+            script->lib_path    = lib_path;
+            script->info        = info;
+            script->source_hash = fingerprint;
+            script->fingerprint = fingerprint;
+            script->tier        = 1;
+            lib_path            = _ssr_str_e();
+            _ssr_script_deps(ssr, script, &deps);
+            ++loaded;
+        } else {
+            _ssr_index_stale(stale, (const uint8_t*) lib_path.b, lib_len);
+            for (size_t j = 0; j < deps_len; ++j)
+                _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&deps, j));
+            _ssr_vec_destroy(&deps);
+        }
+        _ssr_str_destroy(lib_full_path);
+        _ssr_str_destroy(lib_path);
+        _ssr_str_destroy(id);
+    }
+    if (same_key)
+        _ssr_log(SSR_CB_INFO, "Loaded %d of %d scripts from the index", (int) loaded, (int) count);
+
+    uint64_t superseded;
+    if (end - cur < 8) goto end;
+    memcpy(&superseded, cur, sizeof(uint64_t));
+    cur += 8;
+    for (uint64_t i = 0; i < superseded; ++i) {
+        uint32_t lib_len;
+        if (end - cur < 4) break;
+        memcpy(&lib_len, cur, sizeof(uint32_t));
+        cur += 4;
+        if ((size_t) (end - cur) < lib_len) break;
+        _ssr_index_stale(stale, cur, lib_len);
+        cur += lib_len;
+    }
+
+end:
+    _ssr_file_unmap(beg, len);
+}
+
+
+// One pass of the daemon over the instance, returns how long until the next one is needed.
+// -1 if the daemon can wait for changes.
+static int _ssr_serve(ssr_t* ssr) {
+    _ssr_on_pending(ssr);
+    _ssr_on_unwatched(ssr);
+    int timeout_ms = _ssr_on_changes(ssr);
+    int pgo_ms     = _ssr_on_pgo(ssr);
+    if (pgo_ms >= 0 && (timeout_ms < 0 || pgo_ms < timeout_ms)) timeout_ms = pgo_ms;
+    int idle_ms = _ssr_on_idle(ssr);
+    if (idle_ms >= 0 && (timeout_ms < 0 || idle_ms < timeout_ms)) timeout_ms = idle_ms;
+    if (!_ssr_on_retired(ssr) && (timeout_ms < 0 || timeout_ms > SSR_SLEEP_MS))
+        timeout_ms = SSR_SLEEP_MS;
+    _ssr_trim(ssr, NULL);
+    _ssr_index_save(ssr);
+    return timeout_ms;
+}
+
+// Events of the shared watch go to the instance whose root they are in, headers can be
+// included from anywhere by any of them
+static void _ssr_service_on_change(void* args, const char* base, const char* filename) {
+    _ssr_service_t* service = (_ssr_service_t*) args;
+    _ssr_lock_acq(&service->lock);
+    size_t instances_len = _ssr_vec_len(&service->instances);
+    for (size_t i = 0; i < instances_len; ++i) {
+        ssr_t* ssr = *(ssr_t**) _ssr_vec_at(&service->instances, i);
+        _ssr_log(0, NULL, ssr);
+        if (_ssr_path_in(ssr->root, base)) {
+            _ssr_on_change(ssr, base, filename);
+        } else {
+            _ssr_str_t full_path = _ssr_str_f("%s/%s", base, filename);
+            _ssr_on_header(ssr, full_path.b);
+            _ssr_str_destroy(full_path);
+        }
+    }
+    _ssr_lock_rel(&service->lock);
+    _ssr_log(0, NULL, NULL);
+}
+
+// Roots are watched by the daemon, the first pass happens before it ever waits
+static void _ssr_service_watch(_ssr_service_t* service) {
+    size_t unwatched_len = _ssr_vec_len(&service->unwatched);
+    for (size_t i = 0; i < unwatched_len; ++i) {
+        _ssr_str_t* root = (_ssr_str_t*) _ssr_vec_at(&service->unwatched, i);
+        _ssr_watch_unroot(&service->watch, root->b);
+        _ssr_str_destroy(*root);
+    }
+    _ssr_vec_clear(&service->unwatched);
+
+    size_t instances_len = _ssr_vec_len(&service->instances);
+    for (size_t i = 0; i < instances_len; ++i) {
+        ssr_t* ssr = *(ssr_t**) _ssr_vec_at(&service->instances, i);
+        if (ssr->watched == 0) ssr->watched = _ssr_watch_root(&service->watch, ssr->root) ? 1 : -1;
+    }
+}
 
 //@main
 #ifdef _WIN32 // && _MSC_VER
@@ -1573,171 +5044,673 @@ static DWORD WINAPI
 static void*
 #endif
 _ssr_main(void* args) {
-    ssr_t* ssr = (ssr_t*) args;
+    _ssr_service_t* service = (_ssr_service_t*) args;
+
+    while (!_ssr_load_u32(&service->quit)) {
+        int timeout_ms = -1;
+        _ssr_lock_acq(&service->lock);
+        _ssr_service_watch(service);
+        size_t instances_len = _ssr_vec_len(&service->instances);
+        for (size_t i = 0; i < instances_len; ++i) {
+            ssr_t* ssr = *(ssr_t**) _ssr_vec_at(&service->instances, i);
+            _ssr_log(0, NULL, ssr);
+            int ssr_ms = _ssr_serve(ssr);
+            if (ssr_ms >= 0 && (timeout_ms < 0 || ssr_ms < timeout_ms)) timeout_ms = ssr_ms;
+        }
+        _ssr_lock_rel(&service->lock);
+        _ssr_log(0, NULL, NULL);
+
+        // Only changed files are visited when notifications are available
+        if (_ssr_watch_wait(&service->watch, timeout_ms, _ssr_service_on_change, service))
+            continue;
+
+        _ssr_lock_acq(&service->lock);
+        instances_len = _ssr_vec_len(&service->instances);
+        for (size_t i = 0; i < instances_len; ++i) {
+            ssr_t* ssr = *(ssr_t**) _ssr_vec_at(&service->instances, i);
+            _ssr_log(0, NULL, ssr);
+            if (ssr->watched == 1) {
+                _ssr_log(SSR_CB_WARN, "Out of inotify watches, polling %s instead", ssr->root);
+                ssr->watched = -1;
+            }
+            _ssr_iter_dir(ssr->root, _ssr_on_change, ssr);
+            _ssr_poll_headers(ssr);
+        }
+        _ssr_lock_rel(&service->lock);
+        _ssr_log(0, NULL, NULL);
+        _ssr_sleep(SSR_SLEEP_MS);
+    }
 
-    _ssr_str_t bin_dir = _ssr_str_f("%s/%s", ssr->root, SSR_BIN_DIR);
-    ssr->bin           = bin_dir.b;
+    return EXIT_SUCCESS;
+}
 
-    // Setting up logging for current instance
-    _ssr_log(0, NULL, ssr);
-    //_ssr_log(SSR_CB_INFO, "Watcher running on %s", ssr->root);
+// Starts the service if this is the first instance, otherwise adds workers to the pool if
+// num_jobs asks for more. The daemon starts serving the instance on its next pass.
+static bool _ssr_service_attach(ssr_t* ssr, size_t num_jobs) {
+    _ssr_service_t* service = &_ssr_service;
+    _ssr_once(&_ssr_service_once, _ssr_service_init);
+    _ssr_lock_acq(&service->run_lock);
+    if (service->refs == 0) {
+        service->quit = 0;
+        _ssr_lock(&service->lock);
+        _ssr_vec(&service->instances, sizeof(ssr_t*), 8);
+        _ssr_vec(&service->unwatched, sizeof(_ssr_str_t), 8);
+        if (!_ssr_pool(&service->pool, num_jobs)) {
+            _ssr_log(SSR_CB_ERR, "Failed to start %d compile jobs", (int) num_jobs);
+            goto error;
+        }
 
-    // Removing current bin directory
-    _ssr_new_dir(bin_dir.b);
+        // If it fails the daemon polls
+        _ssr_watch(&service->watch);
+        if (!_ssr_thread(&service->thread, (void*) _ssr_main, service)) {
+            _ssr_log(SSR_CB_ERR, "Failed to start the daemon");
+            _ssr_pool_destroy(&service->pool);
+            _ssr_watch_destroy(&service->watch);
+            goto error;
+        }
+    } else if (!_ssr_pool_grow(&service->pool, num_jobs)) {
+        _ssr_log(SSR_CB_WARN,
+            "Failed to start %d compile jobs, sharing %d",
+            (int) num_jobs,
+            (int) service->pool.num_threads);
+    }
 
-    while ((ssr->state & 0x1) == 0) {
-        _ssr_iter_dir(ssr->root, _ssr_on_file, ssr);
-        _ssr_sleep(SSR_SLEEP_MS);
+    _ssr_lock_acq(&service->lock);
+    _ssr_vec_push(&service->instances, &ssr);
+    _ssr_lock_acq(&service->wake_lock);
+    ++service->refs;
+    _ssr_lock_rel(&service->wake_lock);
+    ssr->state |= 0x4;
+    _ssr_lock_rel(&service->lock);
+    _ssr_watch_wake(&service->watch);
+    _ssr_lock_rel(&service->run_lock);
+    return true;
+
+error:
+    _ssr_vec_destroy(&service->instances);
+    _ssr_vec_destroy(&service->unwatched);
+    _ssr_lock_destroy(&service->lock);
+    _ssr_lock_rel(&service->run_lock);
+    return false;
+}
+
+// Once it returns the daemon is done with the instance, builds might still be running. The
+// last instance stops the service.
+static void _ssr_service_detach(ssr_t* ssr) {
+    _ssr_service_t* service = &_ssr_service;
+    _ssr_lock_acq(&service->run_lock);
+    _ssr_lock_acq(&service->lock);
+    _ssr_vec_remove(&service->instances, &ssr);
+    if (ssr->watched == 1) {
+        _ssr_str_t root = _ssr_str(ssr->root);
+        _ssr_vec_push(&service->unwatched, &root);
+    }
+    ssr->state &= ~0x4;
+    _ssr_lock_acq(&service->wake_lock);
+    bool last = --service->refs == 0;
+    _ssr_lock_rel(&service->wake_lock);
+    _ssr_lock_rel(&service->lock);
+    _ssr_watch_wake(&service->watch);
+    if (!last) {
+        _ssr_lock_rel(&service->run_lock);
+        return;
     }
 
-    _ssr_str_destroy(bin_dir);
-    return EXIT_SUCCESS;
+    _ssr_store_u32(&service->quit, 1);
+    _ssr_watch_wake(&service->watch);
+    _ssr_thread_join(&service->thread);
+    _ssr_pool_destroy(&service->pool);
+    _ssr_watch_destroy(&service->watch);
+
+    size_t unwatched_len = _ssr_vec_len(&service->unwatched);
+    for (size_t i = 0; i < unwatched_len; ++i)
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&service->unwatched, i));
+    _ssr_vec_destroy(&service->unwatched);
+    _ssr_vec_destroy(&service->instances);
+    _ssr_lock_destroy(&service->lock);
+    _ssr_lock_rel(&service->run_lock);
 }
 #else
 static void _ssr_add_file_cb(void* args, const char* base, const char* filename) {
+    if (!_ssr_script_ext(filename)) return;
     _ssr_vec_t* files    = (_ssr_vec_t*) args;
     _ssr_str_t full_path = _ssr_str_f("%s/%s", base, filename);
     _ssr_vec_push(files, &full_path);
 }
-#endif
 
-SSR_DEF bool ssr_run(struct ssr_t* ssr) {
-#ifdef SSR_LIVE
-    if (_ssr_thread(&ssr->thread, (void*) _ssr_main, ssr)) {
-        // ERROR: Failed to launch thread
-        return false;
+// Compiling a single script to object file, run on the pool
+typedef struct __ssr_obj_job_t {
+    ssr_t* ssr;          // logs
+    ssr_config_t config; // copy of the instance's with SSR_SCRIPTID appended to the defines
+    char* define;        // SSR_SCRIPTID, NULL for SSR_FLAGS_UNITY which defines it in the unit
+    _ssr_str_t path;
+    _ssr_str_t out;
+    uint32_t* failed; // shared by all the jobs, _ssr_load_u32() / _ssr_store_u32()
+
+    // SSR_FLAGS_CACHE, if keyed out is replaced by the path in the cache
+    const char* bin;
+    _ssr_hash_t toolchain;
+    _ssr_hash_t key;
+    bool keyed;
+    bool hit;
+} _ssr_obj_job_t;
+
+static void _ssr_obj_job(void* args) {
+    _ssr_obj_job_t* job = (_ssr_obj_job_t*) args;
+    _ssr_log(0, NULL, job->ssr);
+    if (_ssr_load_u32(job->failed)) return; // something else already failed, not going to link
+
+    job->keyed = (job->config.flags & SSR_FLAGS_CACHE) &&
+                 _ssr_cache_key(job->path.b,
+                     &job->config,
+                     job->bin,
+                     job->toolchain,
+                     _SSR_COMPILE,
+                     &job->key);
+    if (job->keyed) {
+        _ssr_str_destroy(job->out);
+        job->out = _ssr_cache_path(job->bin, job->key, "obj");
+        if (!_ssr_cache_build(job->path.b, &job->config, job->out.b, _SSR_COMPILE, &job->hit))
+            _ssr_store_u32(job->failed, 1);
+        return;
+    }
+
+    if (!_ssr_compile(job->path.b, &job->config, job->out.b, _SSR_COMPILE))
+        _ssr_store_u32(job->failed, 1);
+}
+
+typedef struct __ssr_registry_sym_t {
+    _ssr_str_t id;
+    _ssr_str_t fname;
+} _ssr_registry_sym_t;
+
+typedef struct __ssr_registry_args_t {
+    _ssr_vec_t* ids; // sorted
+    _ssr_vec_t* syms;
+} _ssr_registry_args_t;
+
+static int _ssr_str_cmp(const void* a, const void* b) {
+    return strcmp(((const _ssr_str_t*) a)->b, ((const _ssr_str_t*) b)->b);
+}
+
+// Directory first, then filename
+static int _ssr_path_cmp(const void* _a, const void* _b) {
+    const char* a = ((const _ssr_str_t*) _a)->b;
+    const char* b = ((const _ssr_str_t*) _b)->b;
+    size_t a_dir  = strlen(a);
+    size_t b_dir  = strlen(b);
+    while (a_dir > 0 && a[a_dir - 1] != '/' && a[a_dir - 1] != '\\') --a_dir;
+    while (b_dir > 0 && b[b_dir - 1] != '/' && b[b_dir - 1] != '\\') --b_dir;
+
+    int ret = strncmp(a, b, a_dir < b_dir ? a_dir : b_dir);
+    if (ret != 0) return ret;
+    if (a_dir != b_dir) return a_dir < b_dir ? -1 : 1;
+    return strcmp(a + a_dir, b + b_dir);
+}
+
+// Exported as <script_id>$<fname> by ssr_func(), an object can contain more than one script
+// with SSR_FLAGS_UNITY. Script ids contain SSR_SEP as well, function names don't.
+static void _ssr_registry_sym(void* args, const char* name) {
+    _ssr_registry_args_t* reg = (_ssr_registry_args_t*) args;
+    const char* sep           = strrchr(name, SSR_SEP);
+    if (sep == NULL) return;
+    size_t id_len = (size_t)(sep - name);
+
+    size_t beg = 0;
+    size_t end = _ssr_vec_len(reg->ids);
+    while (beg < end) {
+        size_t mid           = beg + (end - beg) / 2;
+        const _ssr_str_t* id = (const _ssr_str_t*) _ssr_vec_at(reg->ids, mid);
+        int cmp              = strncmp(name, id->b, id_len);
+        if (cmp == 0) cmp = id->b[id_len] == '\0' ? 0 : -1;
+        if (cmp == 0) {
+            _ssr_registry_sym_t sym;
+            sym.id    = _ssr_str(id->b);
+            sym.fname = _ssr_str(sep + 1);
+            _ssr_vec_push(reg->syms, &sym);
+            return;
+        }
+        if (cmp < 0)
+            end = mid;
+        else
+            beg = mid + 1;
+    }
+}
+
+static int _ssr_registry_cmp(const void* _a, const void* _b) {
+    const _ssr_registry_sym_t* a = (const _ssr_registry_sym_t*) _a;
+    const _ssr_registry_sym_t* b = (const _ssr_registry_sym_t*) _b;
+    int ret                      = strcmp(a->id.b, b->id.b);
+    return ret != 0 ? ret : strcmp(a->fname.b, b->fname.b);
+}
+
+// Sorts syms and writes the source of the registry to path
+static bool _ssr_registry_write(ssr_t* ssr, const char* path, _ssr_vec_t* syms) {
+    size_t syms_len = _ssr_vec_len(syms);
+    if (syms_len > 0) qsort(syms->beg, syms_len, sizeof(_ssr_registry_sym_t), _ssr_registry_cmp);
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) return false;
+    fprintf(fp, "// Generated by scriptosaurus.h from %s, do not edit\n", ssr->root);
+    fprintf(fp, "#include <stddef.h>\n\n");
+    fprintf(fp, "typedef struct ssr_registry_entry_t {\n");
+    fprintf(fp, "    const char* id;\n    const char* fname;\n    void* addr;\n");
+    fprintf(fp, "} ssr_registry_entry_t;\n\n");
+    fprintf(fp, "typedef struct ssr_registry_t {\n");
+    fprintf(fp, "    size_t len;\n    const ssr_registry_entry_t* entries;\n");
+    fprintf(fp, "} ssr_registry_t;\n\n");
+
+    // Only the address is taken, the signature doesn't matter
+    for (size_t i = 0; i < syms_len; ++i) {
+        _ssr_registry_sym_t* sym = (_ssr_registry_sym_t*) _ssr_vec_at(syms, i);
+        fprintf(fp, "extern void %s%c%s(void);\n", sym->id.b, SSR_SEP, sym->fname.b);
     }
+
+    fprintf(fp, "\nstatic const ssr_registry_entry_t entries[] = {\n");
+    for (size_t i = 0; i < syms_len; ++i) {
+        _ssr_registry_sym_t* sym = (_ssr_registry_sym_t*) _ssr_vec_at(syms, i);
+        fprintf(fp,
+            "    {\"%s\", \"%s\", (void*) &%s%c%s},\n",
+            sym->id.b,
+            sym->fname.b,
+            sym->id.b,
+            SSR_SEP,
+            sym->fname.b);
+    }
+    fprintf(fp, "    {NULL, NULL, NULL}, // never empty\n};\n\n");
+    fprintf(fp, "#if defined(_WIN32)\n__declspec(dllexport)\n");
+    fprintf(fp, "#else\n__attribute__((visibility(\"default\")))\n#endif\n");
+    fprintf(fp, "const ssr_registry_t ssr%cregistry = {%d, entries};\n", SSR_SEP, (int) syms_len);
+    fclose(fp);
     return true;
+}
+
+/* Writes SSR_BIN_DIR/registry.c with every function of the scripts in ids (sorted in place)
+   exported by the objects of jobs, sorted so that binding is a binary search instead of a
+   symbol lookup.
+   Returns the compiled object, empty if any of the objects can't be read (LTO), functions are
+   then looked up by name.
+*/
+static _ssr_str_t _ssr_registry(
+    ssr_t* ssr, const char* bin, _ssr_vec_t* ids, _ssr_obj_job_t* jobs, size_t num_jobs) {
+    _ssr_str_t ret = _ssr_str_e();
+    _ssr_str_t src = _ssr_str_f("%s/registry.c", bin);
+    _ssr_vec_t syms;
+    _ssr_vec(&syms, sizeof(_ssr_registry_sym_t), 64);
+
+    qsort(ids->beg, _ssr_vec_len(ids), sizeof(_ssr_str_t), _ssr_str_cmp);
+    bool readable = true;
+    for (size_t i = 0; i < num_jobs && readable; ++i) {
+        _ssr_registry_args_t args = {ids, &syms};
+        readable = _ssr_obj_symbols(jobs[i].out.b, _ssr_registry_sym, &args);
+        if (!readable)
+            _ssr_log(SSR_CB_WARN, "Can't read symbols of %s, not generating a registry", jobs[i].out.b);
+    }
+
+    // Only addresses, nothing to optimize across and it keeps the LTO type checks quiet. It
+    // doesn't include anything from the scripts either.
+    if (readable && _ssr_registry_write(ssr, src.b, &syms)) {
+        ssr_config_t config = *ssr->config;
+        config.flags &= ~SSR_FLAGS_LTO;
+        config.num_prefix_headers = 0;
+        _ssr_str_t obj = _ssr_str_f("%s/registry.obj", bin);
+        if (_ssr_compile(src.b, &config, obj.b, _SSR_COMPILE))
+            ret = obj;
+        else
+            _ssr_str_destroy(obj);
+    }
+
+    for (size_t i = 0; i < _ssr_vec_len(&syms); ++i) {
+        _ssr_registry_sym_t* sym = (_ssr_registry_sym_t*) _ssr_vec_at(&syms, i);
+        _ssr_str_destroy(sym->id);
+        _ssr_str_destroy(sym->fname);
+    }
+    _ssr_vec_destroy(&syms);
+    _ssr_str_destroy(src);
+    return ret;
+}
+#endif
+
+// Concurrent compiler processes asked for by the config
+static size_t _ssr_num_jobs(ssr_t* ssr) {
+    return ssr->config->num_jobs > 0 ? (size_t) ssr->config->num_jobs : _ssr_num_cores();
+}
+
+#if !defined(SSR_LIVE) && !defined(SSR_STATIC_REGISTRY)
+// Compiles the scripts in files, ids has their ids in the same order, into a single library
+// in bin and loads it
+static bool _ssr_build_all(ssr_t* ssr, const char* bin, _ssr_vec_t* files, _ssr_vec_t* ids) {
+    bool ret         = false;
+    size_t files_len = _ssr_vec_len(files);
+    bool cache       = (ssr->config->flags & SSR_FLAGS_CACHE) != 0;
+    bool unity       = (ssr->config->flags & SSR_FLAGS_UNITY) != 0;
+
+    // Prefix headers are precompiled once for all the jobs, SSR_SCRIPTID is left out. It is then
+    // defined by a stub after the precompiled header, gcc rejects it if it's on the command line.
+    _ssr_str_t pch;
+    _ssr_pch(ssr->config, bin, ssr->toolchain, &pch, NULL);
+
+    // Either one job per script or one per unit
+    size_t jobs_len      = 0;
+    _ssr_obj_job_t* jobs = (_ssr_obj_job_t*) malloc(sizeof(_ssr_obj_job_t) * files_len);
+    uint32_t failed      = 0; // written by the jobs while the pool runs
+    for (size_t i = 0; i < files_len;) {
+        _ssr_obj_job_t* job = jobs + jobs_len;
+        job->ssr            = ssr;
+        job->out            = _ssr_str_f("%s/%d.obj", bin, (int) jobs_len);
+        job->failed         = &failed;
+        job->bin            = bin;
+        job->toolchain      = ssr->toolchain;
+        job->keyed          = false;
+        job->hit            = false;
+        job->config         = *ssr->config;
+        job->define         = NULL;
+        if (pch.b != NULL) {
+            job->config.prefix_headers     = &pch.b;
+            job->config.num_prefix_headers = 1;
+        }
+
+        const char* path = ((_ssr_str_t*) _ssr_vec_at(files, i))->b;
+        const char* id   = ((_ssr_str_t*) _ssr_vec_at(ids, i))->b;
+        if (!unity && pch.b != NULL) {
+            job->path = _ssr_str_f("%s/script_%d.c", bin, (int) jobs_len);
+            FILE* fp  = fopen(job->path.b, "wb");
+            if (fp == NULL) {
+                _ssr_log(SSR_CB_ERR, "Failed to write %s", job->path.b);
+                failed = 1;
+            } else {
+                _ssr_str_t include = _ssr_replace_seps(path, '/');
+                fprintf(fp, "// Generated by scriptosaurus.h, do not edit\n");
+                fprintf(fp,
+                    "#define SSR_SCRIPTID %s\n#include \"%s%s\"\n",
+                    id,
+                    include.b,
+                    _ssr_extract_ext(path));
+                _ssr_str_destroy(include);
+                fclose(fp);
+            }
+            ++i;
+        } else if (!unity) {
+            job->path           = _ssr_str(path);
+            job->config.defines = (char**) malloc(sizeof(char*) * (ssr->config->num_defines + 1));
+            for (size_t d = 0; d < ssr->config->num_defines; ++d)
+                job->config.defines[d] = ssr->config->defines[d];
+#if defined(SSR_WIN)
+            job->define = _ssr_str_f("\"SSR_SCRIPTID=%s\"", id).b;
 #else
-    bool ret = false;
-    _ssr_vec_t files;
-    _ssr_vec(&files, sizeof(_ssr_str_t), 12);
-    _ssr_iter_dir(ssr->root, _ssr_add_file_cb, &files);
+            job->define = _ssr_str_f("'SSR_SCRIPTID=%s'", id).b;
+#endif
+            job->config.defines[job->config.num_defines++] = job->define;
+            ++i;
+        } else {
+            // Scripts are included relative to the unit, SSR_BIN_DIR is a child of root
+            job->path = _ssr_str_f("%s/unity_%d.c", bin, (int) jobs_len);
+            FILE* fp  = fopen(job->path.b, "wb");
+            if (fp == NULL) {
+                _ssr_log(SSR_CB_ERR, "Failed to write %s", job->path.b);
+                failed = 1;
+            } else
+                fprintf(fp, "// Generated by scriptosaurus.h, do not edit\n");
+
+            const char* dir_end = strrchr(id, SSR_SEP);
+            size_t dir_len      = (size_t)(dir_end != NULL ? dir_end - id : 0);
+            for (; i < files_len; ++i) {
+                const char* unit_id = ((_ssr_str_t*) _ssr_vec_at(ids, i))->b;
+                const char* sep     = strrchr(unit_id, SSR_SEP);
+                size_t unit_dir_len = (size_t)(sep != NULL ? sep - unit_id : 0);
+                if (unit_dir_len != dir_len || strncmp(unit_id, id, dir_len) != 0) break;
+                if (fp == NULL) continue;
+
+                const char* unit_path = ((_ssr_str_t*) _ssr_vec_at(files, i))->b;
+                const char* rel       = _ssr_extract_rel(ssr->root, unit_path);
+                while (*rel == '/' || *rel == '\\') ++rel;
+                _ssr_str_t include = _ssr_replace_seps(rel, '/');
+                fprintf(fp,
+                    "#define SSR_SCRIPTID %s\n#include \"../%s%s\"\n#undef SSR_SCRIPTID\n",
+                    unit_id,
+                    include.b,
+                    _ssr_extract_ext(rel));
+                _ssr_str_destroy(include);
+            }
+            if (fp != NULL) fclose(fp);
+        }
+        ++jobs_len;
+    }
 
-    _ssr_str_t bin = _ssr_str_f("%s/%s", ssr->root, SSR_BIN_DIR);
-    _ssr_new_dir(bin.b);
+    size_t num_jobs = _ssr_num_jobs(ssr);
+    if (num_jobs > jobs_len) num_jobs = jobs_len;
 
-    size_t files_len = _ssr_vec_len(&files);
-    if (files_len == 0) goto end_no_files;
+    _ssr_pool_t pool;
+    if (!_ssr_pool(&pool, num_jobs)) {
+        _ssr_log(SSR_CB_ERR, "Failed to launch compiler threads");
+        failed = 1;
+    } else {
+        for (size_t i = 0; i < jobs_len; ++i)
+            _ssr_pool_push(&pool, _ssr_obj_job, jobs + i);
 
-    char** defines = (char**) malloc(sizeof(char*) * (ssr->config->num_defines + 1));
-    for (size_t i = 0; i < ssr->config->num_defines; ++i)
-        defines[i] = ssr->config->defines[i];
-    ++ssr->config->num_defines;
-    ssr->config->defines = defines;
+        // All objects are needed before linking
+        _ssr_pool_destroy(&pool);
+    }
 
+    // The library is keyed on all its objects, if any of them is not cached neither is the library
+    bool link_keyed         = cache;
+    _ssr_hash_t link_key    = _ssr_hash_config(ssr->config, _SSR_LINK, ssr->toolchain);
     size_t linker_input_len = 0;
-    size_t linker_input_cap = 1024;
-    char* linker_input      = (char*) malloc(linker_input_cap);
-    linker_input[0]         = '\0';
-    for (size_t i = 0; i < files_len; ++i) {
-        _ssr_str_t* path = (_ssr_str_t*) _ssr_vec_at(&files, i);
-        _ssr_str_t out   = _ssr_str_f("%s/%d.obj", bin.b, i);
+    for (size_t i = 0; i < jobs_len; ++i) {
+        linker_input_len += strlen(jobs[i].out.b) + 1;
+        link_keyed = link_keyed && jobs[i].keyed;
+        link_key   = _ssr_hash(&jobs[i].key, sizeof(_ssr_hash_t), link_key);
+        if (jobs[i].keyed) {
+            if (jobs[i].hit)
+                ++ssr->stats.cache_hits;
+            else
+                ++ssr->stats.cache_misses;
+        }
+    }
 
-        size_t out_len = strlen(out.b);
-        if (out_len + linker_input_len > linker_input_cap) {
-            linker_input = (char*) realloc(linker_input, linker_input_cap * 2); // TODO: max..
-            linker_input_cap *= 2;
+    // The registry is derived from the objects, the key already covers it. Not needed if the
+    // library is cached and nothing is archived.
+    bool archive        = (ssr->config->flags & SSR_FLAGS_STATIC) != 0;
+    _ssr_str_t out      = link_keyed ? _ssr_cache_path(bin, link_key, _ssr_lib_ext()) :
+                                       _ssr_str_f("%s/%s.%s", bin, "ssr", _ssr_lib_ext());
+    _ssr_str_t registry = _ssr_str_e();
+    if (!failed && (archive || !link_keyed || !_ssr_file_exists(out.b)))
+        registry = _ssr_registry(ssr, bin, ids, jobs, jobs_len);
+    if (registry.b != NULL) linker_input_len += strlen(registry.b) + 1;
+
+    char* linker_input = (char*) malloc(linker_input_len + 1);
+    linker_input[0]    = '\0';
+    for (size_t i = 0; i < jobs_len; ++i) {
+        if (i > 0) strcat(linker_input, " ");
+        strcat(linker_input, jobs[i].out.b);
+        _ssr_str_destroy(jobs[i].out);
+        _ssr_str_destroy(jobs[i].path);
+        if (jobs[i].define != NULL) {
+            free(jobs[i].define);
+            free(jobs[i].config.defines);
         }
+    }
+    free(jobs);
+    if (registry.b != NULL) {
+        strcat(linker_input, " ");
+        strcat(linker_input, registry.b);
+    }
+
+    if (failed) goto end;
 
-        if (i == 0)
-            snprintf(linker_input, linker_input_cap, "%s", out.b);
+    bool link_ret;
+    if (link_keyed) {
+        bool hit;
+        link_ret = _ssr_cache_build(linker_input, ssr->config, out.b, _SSR_LINK, &hit);
+        if (hit)
+            ++ssr->stats.cache_hits;
         else
-            snprintf(linker_input, linker_input_cap, "%s %s", linker_input, out.b);
-        linker_input_len += out_len;
-
-        // In order to avoid name clashes <script-id>_<func>
-        const char* script_rel =
-            _ssr_extract_rel(ssr->root, ((_ssr_str_t*) _ssr_vec_at(&files, i))->b);
-        _ssr_str_t script_id = _ssr_replace_seps(script_rel, SSR_SEP);
-        char buf[1024];
-        size_t buf_len = snprintf(buf, 1024, "\"SSR_SCRIPTID=%s\"", script_id.b);
-        _ssr_str_destroy(script_id);
-        defines[ssr->config->num_defines - 1] = (char*) malloc(buf_len + 1);
-        _ssr_strncpy(defines[ssr->config->num_defines - 1], buf, buf_len + 1);
-
-        bool ret = _ssr_compile(path->b, ssr->config, out.b, _SSR_COMPILE);
-        _ssr_str_destroy(out);
-        free(defines[ssr->config->num_defines - 1]);
-        if (!ret) goto end_no_lib;
-    }
-
-    _ssr_str_t out = _ssr_str_f("%s/%s.%s", bin.b, "ssr", _ssr_lib_ext());
-    bool link_ret  = _ssr_compile(linker_input, ssr->config, out.b, _SSR_LINK);
+            ++ssr->stats.cache_misses;
+    } else {
+        link_ret = _ssr_compile(linker_input, ssr->config, out.b, _SSR_LINK);
+    }
     if (!link_ret) goto end;
 
-    // loading library & hooking up functions
-    _ssr_lib(&ssr->lib, out.b); // todo check valid
+    if (archive) {
+        _ssr_str_t archive_out = _ssr_str_f("%s/%s.%s", bin, "ssr", _ssr_archive_ext());
+        if (registry.b == NULL || !_ssr_compile(linker_input, ssr->config, archive_out.b, _SSR_ARCHIVE))
+            _ssr_log(SSR_CB_ERR, "Failed to archive scripts in %s", archive_out.b);
+        _ssr_str_destroy(archive_out);
+    }
 
-    ret = true;
+    // loading library & hooking up functions
+    ret = _ssr_lib(&ssr->lib, out.b);
+    if (ret) ssr->registry = (const ssr_registry_t*) _ssr_lib_func_addr(&ssr->lib, "ssr$registry");
 
 end:
+    _ssr_str_destroy(registry);
     _ssr_str_destroy(out);
-end_no_lib:
+    _ssr_str_destroy(pch);
     free(linker_input);
-    free(defines);
-end_no_files:
+    return ret;
+}
+
+#endif
+
+SSR_DEF bool ssr_run(struct ssr_t* ssr) {
+#ifdef SSR_LIVE
+    _ssr_log(0, NULL, ssr);
+    if (ssr->config->compiler == SSR_COMPILER_TCC && !_ssr_tcc_load()) return false;
+
+    // Creating bin directory, previous artifacts are left alone
+    ssr->bin = _ssr_str_f("%s/%s", ssr->root, SSR_BIN_DIR).b;
+    _ssr_new_dir(ssr->bin);
+    if (ssr->config->flags & SSR_FLAGS_CACHE) {
+        _ssr_str_t cache_dir = _ssr_str_f("%s/cache", ssr->bin);
+        _ssr_new_dir(cache_dir.b);
+        _ssr_str_destroy(cache_dir);
+    }
+
+#if defined(SSR_SHM_DIR)
+    // One directory per instance, removed by ssr_destroy(). SSR_SHM_DIR is writable by anyone
+    // and libraries are loaded from it, mkdtemp() creates it atomically and only for us (0700).
+    if (ssr->config->flags & SSR_FLAGS_SHM) {
+        ssr->shm = _ssr_str_f("%s/ssr.XXXXXX", SSR_SHM_DIR).b;
+        if (mkdtemp(ssr->shm) == NULL) {
+            _ssr_log(SSR_CB_WARN, "Failed to create %s, building in %s", ssr->shm, ssr->bin);
+            free(ssr->shm);
+            ssr->shm = NULL;
+        }
+    }
+#endif
+
+    // Libraries still matching their source are loaded before the first ssr_add()
+    ssr->toolchain = _ssr_toolchain(ssr->config);
+    _ssr_map_t stale;
+    _ssr_map(&stale, sizeof(_ssr_path_t), 0);
+    _ssr_index_load(ssr, &stale);
+    _ssr_trim(ssr, &stale);
+    _ssr_map_iter(&stale, _ssr_path_destroy, NULL);
+    _ssr_map_destroy(&stale);
+
+    // Root is watched before the daemon builds anything added from now on
+    return _ssr_service_attach(ssr, _ssr_num_jobs(ssr));
+#elif defined(SSR_STATIC_REGISTRY)
+    // Scripts have been linked into the host
+    _ssr_log(0, NULL, ssr);
+    ssr->registry = &ssr$registry;
+    return true;
+#else
+    _ssr_log(0, NULL, ssr);
+    if (ssr->config->compiler == SSR_COMPILER_TCC && !_ssr_tcc_load()) return false;
+
+    _ssr_vec_t files;
+    _ssr_vec(&files, sizeof(_ssr_str_t), 12);
+    _ssr_iter_dir(ssr->root, _ssr_add_file_cb, &files);
+
+    _ssr_str_t bin = _ssr_str_f("%s/%s", ssr->root, SSR_BIN_DIR);
+    _ssr_new_dir(bin.b);
+
+    bool cache = (ssr->config->flags & SSR_FLAGS_CACHE) != 0;
+    if (cache) {
+        _ssr_str_t cache_dir = _ssr_str_f("%s/cache", bin.b);
+        _ssr_new_dir(cache_dir.b);
+        _ssr_str_destroy(cache_dir);
+    }
+    if (cache || ssr->config->num_prefix_headers > 0) ssr->toolchain = _ssr_toolchain(ssr->config);
+
+    size_t files_len = _ssr_vec_len(&files);
+    _ssr_vec_t ids;
+    _ssr_vec(&ids, sizeof(_ssr_str_t), files_len + 1);
+
+    // Scripts in the same directory are next to each other, they form a unit
+    if (ssr->config->flags & SSR_FLAGS_UNITY)
+        qsort(files.beg, files_len, sizeof(_ssr_str_t), _ssr_path_cmp);
+
+    // In order to avoid name clashes <script-id>_<func>
+    for (size_t i = 0; i < files_len; ++i) {
+        const char* path       = ((_ssr_str_t*) _ssr_vec_at(&files, i))->b;
+        const char* script_rel = _ssr_extract_rel(ssr->root, path);
+        _ssr_str_t script_id   = _ssr_replace_seps(script_rel, SSR_SEP);
+        _ssr_vec_push(&ids, &script_id);
+    }
+
+    bool ret = files_len > 0 && _ssr_build_all(ssr, bin.b, &files, &ids);
     _ssr_str_destroy(bin);
 
-    for (size_t i = 0; i < files_len; ++i)
+    for (size_t i = 0; i < files_len; ++i) {
         _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&files, i));
+        _ssr_str_destroy(*(_ssr_str_t*) _ssr_vec_at(&ids, i));
+    }
+    _ssr_vec_destroy(&ids);
     _ssr_vec_destroy(&files);
     return ret;
 #endif
 }
 
-SSR_DEF bool
-ssr_add(struct ssr_t* ssr, const char* script_id, const char* fname, ssr_func_t* user_routine) {
-#ifdef SSR_LIVE
-    _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, script_id);
-
-    // First time request
-    if (script == NULL) {
-        _ssr_script_t new_script;
-        _ssr_vec(&new_script.routines, sizeof(_ssr_routine_t), 32);
-        new_script.last_seen    = 0;
-        new_script.last_written = 0;
-        new_script.rnd_id.b     = NULL;
-        new_script.id           = _ssr_str(script_id);
-        new_script.lib.h        = NULL;
-        _ssr_map_add_str(&ssr->scripts, &new_script);
-    }
-    script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, script_id); // TODO can be avoided
-
-    _ssr_routine_t* routine = NULL;
-    size_t routines_len     = _ssr_vec_len(&script->routines);
-    for (size_t i = 0; i < routines_len; ++i) {
-        _ssr_routine_t* _routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
-        if (strcmp(fname, _routine->name.b) == 0) {
-            routine = _routine;
-            break;
+#ifndef SSR_LIVE
+// Registry if there is one, otherwise exported as <script_id>$<fname>. Not allocating for
+// reasonable lengths.
+static void* _ssr_func_addr(ssr_t* ssr, const char* script_id, const char* fname) {
+    if (ssr->registry != NULL) {
+        size_t beg = 0;
+        size_t end = ssr->registry->len;
+        while (beg < end) {
+            size_t mid                        = beg + (end - beg) / 2;
+            const ssr_registry_entry_t* entry = ssr->registry->entries + mid;
+            int cmp                           = strcmp(script_id, entry->id);
+            if (cmp == 0) cmp = strcmp(fname, entry->fname);
+            if (cmp == 0) return entry->addr;
+            if (cmp < 0)
+                end = mid;
+            else
+                beg = mid + 1;
         }
+        return NULL;
     }
 
-    if (routine == NULL) {
-        _ssr_routine_t new_routine;
-        new_routine.name = _ssr_str(fname);
-        new_routine.addr = NULL;
-        _ssr_vec(&new_routine.moos, sizeof(void*), 32);
-        _ssr_lock(&new_routine.moos_lock);
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf), "%s%c%s", script_id, SSR_SEP, fname);
+    if (len >= 0 && (size_t) len < sizeof(buf)) return _ssr_lib_func_addr(&ssr->lib, buf);
 
-        _ssr_lock_acq(&new_routine.moos_lock);
-        _ssr_vec_push(&new_routine.moos, &user_routine);
-        _ssr_lock_rel(&new_routine.moos_lock);
+    _ssr_str_t func = _ssr_str_f("%s%c%s", script_id, SSR_SEP, fname);
+    void* ret       = _ssr_lib_func_addr(&ssr->lib, func.b);
+    _ssr_str_destroy(func);
+    return ret;
+}
+#endif
 
-        _ssr_vec_push(&script->routines, &new_routine);
-        routine =
-            (_ssr_routine_t*) _ssr_vec_at(&script->routines, _ssr_vec_len(&script->routines) - 1);
-    }
+SSR_DEF bool
+ssr_add(struct ssr_t* ssr, const char* script_id, const char* fname, ssr_func_t* user_routine) {
+#ifdef SSR_LIVE
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script   = _ssr_script_get(ssr, script_id);
+    _ssr_routine_t* routine = _ssr_routine_get(ssr, script, fname, _ssr_hash_str(fname, 0));
+    _ssr_routine_ref(script, routine);
 
-    // Registering as listener
-    void* routine_addr = routine->addr;
-    if (routine_addr != NULL)
-        *user_routine = routine_addr; // Might be already up to date but not a problem
+    _ssr_lock_acq(&routine->moos_lock);
+    _ssr_vec_push(&routine->moos, &user_routine);
+    if (routine->addr != NULL) _ssr_store_ptr(user_routine, routine->addr);
+    _ssr_lock_rel(&routine->moos_lock);
+    _ssr_lock_rel(&ssr->lock);
 
 #else
-    _ssr_str_t func = _ssr_str_f("%s$%s", script_id, fname);
-    void* fptr      = _ssr_lib_func_addr(&ssr->lib, func.b);
+    void* fptr = _ssr_func_addr(ssr, script_id, fname);
     if (fptr == NULL) {
         // todo log
         return false;
@@ -1750,20 +5723,23 @@ ssr_add(struct ssr_t* ssr, const char* script_id, const char* fname, ssr_func_t*
 SSR_DEF void
 ssr_remove(struct ssr_t* ssr, const char* script_id, const char* fname, ssr_func_t* user_routine) {
 #ifdef SSR_LIVE
+    _ssr_lock_acq(&ssr->lock);
     _ssr_script_t* script = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, script_id);
-    if (script == NULL) return;
-
-    size_t num_routines = _ssr_vec_len(&script->routines);
-    for (size_t i = 0; i < num_routines; ++i) {
-        _ssr_routine_t* routine = (_ssr_routine_t*) _ssr_vec_at(&script->routines, i);
-        if (strcmp(routine->name.b, fname) == 0) {
-            _ssr_vec_remove(&routine->moos, &user_routine);
+    if (script == NULL) {
+        _ssr_lock_rel(&ssr->lock);
+        return;
+    }
 
-            if (_ssr_vec_len(&routine->moos) == 0) {
-            } // TODO: Remove subnode
-            return;
-        }
+    _ssr_routine_t* routine = _ssr_routine_find(script, fname, _ssr_hash_str(fname, 0));
+    if (routine != NULL) {
+        _ssr_lock_acq(&routine->moos_lock);
+        size_t moos_len = _ssr_vec_len(&routine->moos);
+        _ssr_vec_remove(&routine->moos, &user_routine);
+        bool removed = _ssr_vec_len(&routine->moos) < moos_len;
+        _ssr_lock_rel(&routine->moos_lock);
+        if (removed) _ssr_routine_unref(ssr, script, routine);
     }
+    _ssr_lock_rel(&ssr->lock);
 #else
     (void) ssr;
     (void) script_id;
@@ -1772,13 +5748,178 @@ ssr_remove(struct ssr_t* ssr, const char* script_id, const char* fname, ssr_func
 #endif
 }
 
+#ifndef SSR_LIVE
+// Resolved once, the table never changes
+typedef struct __ssr_static_slot_t {
+    ssr_slot_t slot;
+    void** table;
+    void* addr;
+} _ssr_static_slot_t;
+#endif
+
+SSR_DEF const ssr_slot_t* ssr_slot(struct ssr_t* ssr, const char* script_id, const char* fname) {
+    return ssr_slot_h(ssr, _ssr_hash_str(script_id, 0), script_id, _ssr_hash_str(fname, 0), fname);
+}
+
+SSR_DEF const ssr_slot_t*
+ssr_slot_h(struct ssr_t* ssr,
+    uint64_t hash,
+    const char* script_id,
+    uint64_t fname_hash,
+    const char* fname) {
+#ifdef SSR_LIVE
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script   = _ssr_script_get_h(ssr, script_id, hash);
+    _ssr_routine_t* routine = _ssr_routine_get(ssr, script, fname, fname_hash);
+    if (!routine->pinned) _ssr_routine_ref(script, routine);
+    routine->pinned = true;
+    _ssr_lock_rel(&ssr->lock);
+    return routine->slot;
+#else
+    (void) hash;
+    (void) fname_hash;
+    void* addr = _ssr_func_addr(ssr, script_id, fname);
+    if (addr == NULL) return NULL;
+
+    _ssr_static_slot_t* slot = (_ssr_static_slot_t*) malloc(sizeof(_ssr_static_slot_t));
+    slot->addr               = addr;
+    slot->table              = &slot->addr;
+    slot->slot.table         = (void** const*) &slot->table;
+    slot->slot.idx           = 0;
+    _ssr_vec_push(&ssr->slots, &slot);
+    return &slot->slot;
+#endif
+}
+
 SSR_DEF void ssr_cb(struct ssr_t* ssr, int mask, ssr_cb_t cb) {
     ssr->cb_mask = mask;
     ssr->cb      = cb;
 }
 
+SSR_DEF void ssr_stats(struct ssr_t* ssr, ssr_stats_t* stats) {
+#ifdef SSR_LIVE
+    _ssr_lock_acq(&ssr->lock);
+    *stats = ssr->stats;
+    _ssr_lock_rel(&ssr->lock);
+#else
+    *stats = ssr->stats;
+#endif
+}
+
+SSR_DEF int ssr_tier(struct ssr_t* ssr, const char* script_id, const char* fname) {
+#ifdef SSR_LIVE
+    int ret = -1;
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script   = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, script_id);
+    _ssr_routine_t* routine =
+        script != NULL ? _ssr_routine_find(script, fname, _ssr_hash_str(fname, 0)) : NULL;
+    if (routine != NULL && routine->addr != NULL) ret = script->tier;
+    _ssr_lock_rel(&ssr->lock);
+    return ret;
+#else
+    return _ssr_func_addr(ssr, script_id, fname) != NULL ? 1 : -1;
+#endif
+}
+
+SSR_DEF const uint32_t* ssr_generation(struct ssr_t* ssr, const char* script_id, const char* fname) {
+#ifdef SSR_LIVE
+    const uint32_t* ret = NULL;
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script   = (_ssr_script_t*) _ssr_map_find_str(&ssr->scripts, script_id);
+    _ssr_routine_t* routine =
+        script != NULL ? _ssr_routine_find(script, fname, _ssr_hash_str(fname, 0)) : NULL;
+    if (routine != NULL) {
+        if (!routine->pinned) _ssr_routine_ref(script, routine);
+        routine->pinned = true;
+        ret             = routine->gen;
+    }
+    _ssr_lock_rel(&ssr->lock);
+    return ret;
+#else
+    // Nothing is ever reloaded
+    static const uint32_t gen = 1;
+    (void) ssr;
+    (void) script_id;
+    (void) fname;
+    return &gen;
+#endif
+}
+
+SSR_DEF bool ssr_pgo(struct ssr_t* ssr, const char* script_id, unsigned int window_ms) {
+#ifdef SSR_LIVE
+    _ssr_log(0, NULL, ssr);
+    if (ssr->config->compiler != SSR_COMPILER_GCC || ssr->bin == NULL || window_ms == 0) {
+        _ssr_log(SSR_CB_WARN, "Can't profile %s, only supported by gcc after ssr_run()", script_id);
+        return false;
+    }
+
+    // Exports __gcov_dump() from the instrumented library, the daemon decides when the profile
+    // is written instead of dlclose()
+    _ssr_str_t pgo_dir = _ssr_str_f("%s/pgo", ssr->bin);
+    _ssr_str_t dump    = _ssr_str_f("%s/dump.h", pgo_dir.b);
+    _ssr_new_dir(pgo_dir.b);
+    FILE* fp = _ssr_file_exists(dump.b) ? NULL : fopen(dump.b, "wb");
+    if (fp != NULL) {
+        fprintf(fp, "// Generated by scriptosaurus.h, do not edit\n");
+        fprintf(fp, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n");
+        fprintf(fp, "extern void __gcov_dump(void);\n");
+        fprintf(fp, "__attribute__((visibility(\"default\")))\n");
+        fprintf(fp, "void ssr%cpgo%cdump(void) { __gcov_dump(); }\n", SSR_SEP, SSR_SEP);
+        fprintf(fp, "#ifdef __cplusplus\n}\n#endif\n");
+        fclose(fp);
+    }
+    _ssr_str_destroy(dump);
+    _ssr_str_destroy(pgo_dir);
+
+    // Built right away, as for new routines
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_script_t* script = _ssr_script_get(ssr, script_id);
+    script->pgo_window_ms = window_ms;
+    _ssr_str_t id         = _ssr_str(script_id);
+    _ssr_vec_push(&ssr->pending, &id);
+    _ssr_service_wake();
+    _ssr_lock_rel(&ssr->lock);
+    return true;
+#else
+    // Release is built once with the configuration flags
+    (void) ssr;
+    (void) script_id;
+    (void) window_ms;
+    return false;
+#endif
+}
+
+SSR_DEF ssr_thread_t* ssr_thread_register(struct ssr_t* ssr) {
+    ssr_thread_t* thread = (ssr_thread_t*) calloc(1, sizeof(ssr_thread_t));
+#ifdef SSR_LIVE
+    thread->global = &ssr->epoch;
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_vec_push(&ssr->threads, &thread);
+    _ssr_lock_rel(&ssr->lock);
+#else
+    // Nothing is ever unloaded
+    static const uint32_t epoch = 1;
+    (void) ssr;
+    thread->global = &epoch;
+#endif
+    return thread;
+}
+
+SSR_DEF void ssr_thread_unregister(struct ssr_t* ssr, ssr_thread_t* thread) {
+#ifdef SSR_LIVE
+    _ssr_lock_acq(&ssr->lock);
+    _ssr_vec_remove(&ssr->threads, &thread);
+    _ssr_lock_rel(&ssr->lock);
+#else
+    (void) ssr;
+#endif
+    free(thread);
+}
+
+// Logs go to the instance last set on the calling thread with _ssr_log(0, NULL, ssr), the
+// daemon and the pool serve several of them
 static void _ssr_log(int type, const char* fmt, ...) {
-    static ssr_t* ssr = NULL;
+    static _SSR_TLS ssr_t* ssr = NULL;
 
     if (fmt == NULL) {
         va_list args;
@@ -0,0 +1,85 @@
+#ifndef _SSR_HPP_GUARD_
+#define _SSR_HPP_GUARD_
+
+#include "scriptosaurus.h"
+
+#include <type_traits>
+
+/*-----------------------------------------------------------------------------
+Scriptosaurus C++ API, typed layer on top of scriptosaurus.h
+
+Usage:
+    ssr::fn<float(float)> my_cos(ssr, SSR_ID("math$trig"), SSR_ID("my_cos")); // ssr_t* ssr
+    if (my_cos) x = my_cos(0.f);
+
+    ssr_t is only complete in the translation unit with SSR_IMPLEMENTATION, which can be C or
+    C++, others get a pointer to it. SSR_LIVE has to match it. Script ids and function names
+    passed through SSR_ID() are hashed at compile time. In live calls go through the script's
+    dispatch table (ssr_slot()), in release the function is resolved once when bound and
+    called directly.
+*/
+
+namespace ssr {
+namespace detail {
+// Same as _ssr_hash_str(), which indexes the scripts: 64-bit FNV-1a including the terminator
+constexpr uint64_t fnv(const char* str, uint64_t hval = 0xcbf29ce484222325ULL) {
+    return *str == '\0' ? hval * 0x100000001b3ULL
+                        : fnv(str + 1, (hval ^ (uint64_t)(unsigned char) *str) * 0x100000001b3ULL);
+}
+} // namespace detail
+
+// Script id relative to root with SSR_SEP or function name, see SSR_ID()
+struct id {
+    const char* str;
+    uint64_t hash;
+};
+
+template <typename F> class fn;
+
+template <typename R, typename... Args> class fn<R(Args...)> {
+  public:
+    typedef R (*ptr_t)(Args...);
+
+    fn() {}
+    fn(struct ssr_t* ssr, id script, id name) { bind(ssr, script, name); }
+
+    // Live always succeeds and the function is available once built, release fails if the
+    // function doesn't exist
+    bool bind(struct ssr_t* ssr, id script, id name) {
+#ifdef SSR_LIVE
+        slot = ssr_slot_h(ssr, script.hash, script.str, name.hash, name.str);
+        return slot != NULL;
+#else
+        ssr_func_t addr = NULL;
+        bool ret        = ssr_add(ssr, script.str, name.str, &addr);
+        ptr             = reinterpret_cast<ptr_t>(addr);
+        return ret;
+#endif
+    }
+
+    // Current version, NULL if not built (yet)
+    ptr_t get() const {
+#ifdef SSR_LIVE
+        return slot != NULL ? reinterpret_cast<ptr_t>(ssr_slot_load(slot)) : NULL;
+#else
+        return ptr;
+#endif
+    }
+
+    explicit operator bool() const { return get() != NULL; }
+
+    R operator()(Args... args) const { return get()(static_cast<Args&&>(args)...); }
+
+  private:
+#ifdef SSR_LIVE
+    const ssr_slot_t* slot = NULL;
+#else
+    ptr_t ptr = NULL;
+#endif
+};
+} // namespace ssr
+
+#define SSR_ID(str) \
+    (::ssr::id{str, std::integral_constant<uint64_t, ::ssr::detail::fnv(str)>::value})
+
+#endif // _SSR_HPP_GUARD_